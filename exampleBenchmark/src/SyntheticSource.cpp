@@ -0,0 +1,204 @@
+#include "SyntheticSource.h"
+
+// the sizes of the sdk's hd face model
+static const UINT32 VERTEX_COUNT = 1347;
+static const UINT32 TRIANGLE_COUNT = 2630;
+static const INT64 FRAME_TICKS = 333333; // 30 fps in 100ns units
+
+SyntheticSource::SyntheticSource(int faceCount)
+	: mode(KINECT_SOURCE_FACE)
+	, frames(KINECT_FRAME_ALL)
+	, faceCount(ofClamp(faceCount, 0, BODY_COUNT))
+	, frameIndex(0)
+	, bodyFrameIndex(-1)
+	, time(0)
+{
+}
+
+bool SyntheticSource::open(KinectSourceMode mode, int frames)
+{
+	this->mode = mode;
+	this->frames = frames;
+	frameIndex = 0;
+	bodyFrameIndex = -1;
+	time = 0;
+
+	// an ellipsoid of about a head's size around the pivot
+	shape.resize(VERTEX_COUNT);
+	for (UINT32 i = 0; i < VERTEX_COUNT; i++)
+	{
+		float u = (float)i / VERTEX_COUNT * TWO_PI * 17.f;
+		float v = ((float)i / VERTEX_COUNT - 0.5f) * PI;
+		shape[i].X = 0.08f * cosf(v) * sinf(u);
+		shape[i].Y = 0.11f * sinf(v);
+		shape[i].Z = -0.09f * cosf(v) * cosf(u);
+	}
+	return true;
+}
+
+void SyntheticSource::close()
+{
+}
+
+void SyntheticSource::advanceFrame()
+{
+	frameIndex++;
+	time = frameIndex * FRAME_TICKS;
+}
+
+// faces stand side by side between 1.2m and 2.7m, swaying slightly
+CameraSpacePoint SyntheticSource::getPivot(int idx)
+{
+	float t = frameIndex / 30.f;
+	CameraSpacePoint p;
+	p.X = (idx - 2.5f) * 0.35f + 0.05f * sinf(t + idx);
+	p.Y = 0.1f + 0.02f * cosf(t * 1.3f + idx);
+	p.Z = 1.2f + idx * 0.3f;
+	return p;
+}
+
+Vector4 SyntheticSource::getRotation(int idx)
+{
+	float halfYaw = 0.15f * sinf(frameIndex / 30.f + idx);
+	Vector4 q;
+	q.x = 0.f;
+	q.y = sinf(halfYaw);
+	q.z = 0.f;
+	q.w = cosf(halfYaw);
+	return q;
+}
+
+bool SyntheticSource::acquireColor(ofPixels& pixels, INT64& time)
+{
+	if (!(frames & KINECT_FRAME_COLOR))return false;
+
+	advanceFrame();
+	if (colorPattern.size() != pixels.size())
+	{
+		colorPattern.resize(pixels.size());
+		for (size_t i = 0; i < colorPattern.size(); i++)
+		{
+			colorPattern[i] = (unsigned char)(i * 7);
+		}
+	}
+	memcpy(pixels.getPixels(), colorPattern.data(), pixels.size());
+	time = this->time;
+	return true;
+}
+
+bool SyntheticSource::skipColor(INT64& time)
+{
+	if (!(frames & KINECT_FRAME_COLOR))return false;
+
+	advanceFrame();
+	time = this->time;
+	return true;
+}
+
+bool SyntheticSource::acquireBodies(UINT64* trackingIds, INT64& time)
+{
+	// like a replay, color paces the frames when it is consumed
+	if (!(frames & KINECT_FRAME_COLOR))
+	{
+		advanceFrame();
+	}
+	if (bodyFrameIndex == frameIndex)return false;
+
+	bodyFrameIndex = frameIndex;
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		trackingIds[i] = i < faceCount ? 1000 + i : 0;
+	}
+	time = this->time;
+	return true;
+}
+
+bool SyntheticSource::acquireFaces(KinectFaceData* faces)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		KinectFaceData& face = faces[i];
+		face.isUpdated = face.isActive && i < faceCount;
+		if (!face.isUpdated)continue;
+
+		ColorSpacePoint center;
+		CameraSpacePoint pivot = getPivot(i);
+		projection.project(&pivot, &center, 1);
+		int size = (int)(200.f / pivot.Z);
+		// like the sensor, only the requested features are written
+		face.trackingId = 1000 + i;
+		if (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_BoundingBoxInColorSpace)
+		{
+			face.boundingBox.Left = (int)center.X - size / 2;
+			face.boundingBox.Top = (int)center.Y - size / 2;
+			face.boundingBox.Right = face.boundingBox.Left + size;
+			face.boundingBox.Bottom = face.boundingBox.Top + size;
+		}
+		if (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_PointsInColorSpace)
+		{
+			for (int j = 0; j < FacePointType::FacePointType_Count; j++)
+			{
+				face.points[j].X = center.X + size * 0.2f * cosf(j * TWO_PI / FacePointType::FacePointType_Count);
+				face.points[j].Y = center.Y + size * 0.2f * sinf(j * TWO_PI / FacePointType::FacePointType_Count);
+			}
+		}
+		if (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_RotationOrientation)
+		{
+			face.rotation = getRotation(i);
+		}
+		if (faceFeatures & KINECT_FACE_FEATURE_PROPERTIES)
+		{
+			for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+			{
+				face.properties[j] = (DetectionResult)((frameIndex / 15 + i + j) % 4);
+			}
+		}
+	}
+	return true;
+}
+
+bool SyntheticSource::acquireHDFaces(KinectHDFaceData* hdFaces)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		KinectHDFaceData& face = hdFaces[i];
+		face.isUpdated = face.isActive && i < faceCount;
+		face.isVertexUpdated = false;
+		if (!face.isUpdated)continue;
+
+		face.trackingId = 1000 + i;
+		face.headPivot = getPivot(i);
+		face.orientation = getRotation(i);
+		for (int j = 0; j < FaceShapeAnimations_Count; j++)
+		{
+			face.animationUnits[j] = 0.5f + 0.5f * sinf(frameIndex / 10.f + i + j);
+		}
+
+		// stands in for CalculateVerticesForAlignment, one write per vertex
+		if (face.isVertexRequested && face.vertices && face.vertexCount == VERTEX_COUNT)
+		{
+			float open = 0.01f * face.animationUnits[FaceShapeAnimations_JawOpen];
+			for (UINT32 j = 0; j < VERTEX_COUNT; j++)
+			{
+				face.vertices[j].X = face.headPivot.X + shape[j].X;
+				face.vertices[j].Y = face.headPivot.Y + shape[j].Y - (shape[j].Y < 0.f ? open : 0.f);
+				face.vertices[j].Z = face.headPivot.Z + shape[j].Z;
+			}
+			face.isVertexUpdated = true;
+		}
+	}
+	return true;
+}
+
+bool SyntheticSource::getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles)
+{
+	vertexCount = VERTEX_COUNT;
+	triangles.resize(TRIANGLE_COUNT * 3);
+	for (UINT32 t = 0; t < TRIANGLE_COUNT; t++)
+	{
+		triangles[t * 3] = t % VERTEX_COUNT;
+		triangles[t * 3 + 1] = (t + 1) % VERTEX_COUNT;
+		triangles[t * 3 + 2] = (t + 17) % VERTEX_COUNT;
+	}
+	return true;
+}
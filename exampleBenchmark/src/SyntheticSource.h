@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxKinectFaceSource.h"
+
+// deterministic faces moving in front of a virtual sensor, frames are produced
+// as fast as they are acquired so benchmarks run without a kinect
+class SyntheticSource : public KinectFrameSource
+{
+public:
+	SyntheticSource(int faceCount);
+
+	bool open(KinectSourceMode mode, int frames = KINECT_FRAME_ALL);
+	void close();
+	bool acquireColor(ofPixels& pixels, INT64& time);
+	bool skipColor(INT64& time);
+	bool acquireBodies(UINT64* trackingIds, INT64& time);
+	bool acquireFaces(KinectFaceData* faces);
+	bool acquireHDFaces(KinectHDFaceData* hdFaces);
+	bool getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles);
+
+private:
+	void advanceFrame();
+	CameraSpacePoint getPivot(int idx);
+	Vector4 getRotation(int idx);
+
+	KinectSourceMode mode;
+	int frames;
+	int faceCount;
+	int frameIndex;
+	int bodyFrameIndex;
+	INT64 time;
+	std::vector<CameraSpacePoint> shape; // head relative vertices
+	std::vector<unsigned char> colorPattern;
+};
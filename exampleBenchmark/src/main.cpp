@@ -0,0 +1,36 @@
+#include "ofMain.h"
+#include "ofApp.h"
+#include "ofAppNoWindow.h"
+
+// every allocation of the process is counted, the benchmark reports the ones per frame
+std::atomic<unsigned long long> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount++;
+	void* p = malloc(size ? size : 1);
+	if (!p)throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p)
+{
+	free(p);
+}
+
+//========================================================================
+int main(int argc, char* argv[]){
+	ofAppNoWindow window;
+	// no gl context, the pipelines run headless. draw() and the gpu mesh path need a real
+	// window and driver, they are checked by running exampleHDFace rather than timed here
+	ofSetupOpenGL(&window, 1920, 1080, OF_WINDOW);
+
+	// an optional recording replaces the synthetic faces
+	ofApp* app = new ofApp();
+	if (argc > 1)
+	{
+		app->recordingPath = argv[1];
+	}
+	ofRunApp(app);
+
+}
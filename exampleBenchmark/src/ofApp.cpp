@@ -0,0 +1,757 @@
+#include "ofApp.h"
+#include "SyntheticSource.h"
+
+static const int WARMUP_FRAMES = 30;
+static const int BENCHMARK_FRAMES = 600;
+// microseconds per frame for the adaptive runs, tight enough to raise the quality level
+static const float ADAPTIVE_BUDGET = 2000.f;
+static const int LOOPBACK_PORT = 47810;
+
+// only the face mode has a feature set
+static void setFeatures(ofxKinectFace& face, DWORD features){ face.setFaceFeatures(features); }
+static void setFeatures(ofxKinectHDFace& face, DWORD features){}
+
+//--------------------------------------------------------------
+void ofApp::setup(){
+	csv.open("benchmark.csv", ofFile::WriteOnly);
+	csv << "pipeline,faces,frames,fps,allocations per frame,quality level\n";
+	microCsv.open("micro.csv", ofFile::WriteOnly);
+	microCsv << "operation,iterations,us per iteration,throughput,unit,allocations per iteration\n";
+
+	runYuy2(BENCHMARK_FRAMES / 5);
+	runProjection(BENCHMARK_FRAMES);
+	runAccessors(BENCHMARK_FRAMES);
+	runCodec(BENCHMARK_FRAMES);
+	runFilter(BENCHMARK_FRAMES);
+	runLoopback(BENCHMARK_FRAMES);
+
+	if (recordingPath.size())
+	{
+		// a recording holds one face mode, the other one fails to open
+		run<ofxKinectFace>("face replay", new KinectReplaySource(recordingPath, false, true), 0, BENCHMARK_FRAMES);
+		run<ofxKinectHDFace>("hd face replay", new KinectReplaySource(recordingPath, false, true), 0, BENCHMARK_FRAMES);
+		runLod("hd face replay", new KinectReplaySource(recordingPath, false, true), BENCHMARK_FRAMES, true);
+		runSetup("hd face replay", BENCHMARK_FRAMES / 30);
+		runBatch(recordingPath);
+	}
+	else
+	{
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectFace>("face", new SyntheticSource(faces), faces, BENCHMARK_FRAMES);
+		}
+		// body and face frames only, the color stream is never opened, copied or converted
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectFace>("face no color", new SyntheticSource(faces), faces, BENCHMARK_FRAMES, KINECT_FACE_FEATURES_ALL, 0.f,
+				KinectFilterSettings(), KINECT_FRAME_BODY | KINECT_FRAME_FACE);
+		}
+		// bounding box and rotation only
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectFace>("face minimal", new SyntheticSource(faces), faces, BENCHMARK_FRAMES, KINECT_FACE_FEATURES_MINIMAL);
+		}
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectHDFace>("hd face", new SyntheticSource(faces), faces, BENCHMARK_FRAMES);
+		}
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectHDFace>("hd face no color", new SyntheticSource(faces), faces, BENCHMARK_FRAMES, KINECT_FACE_FEATURES_ALL, 0.f,
+				KinectFilterSettings(), KINECT_FRAME_BODY | KINECT_FRAME_FACE);
+		}
+		// the quality scheduler trading vertices, color and face updates for frame time
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectHDFace>("hd face adaptive", new SyntheticSource(faces), faces, BENCHMARK_FRAMES, KINECT_FACE_FEATURES_ALL, ADAPTIVE_BUDGET);
+		}
+		// every channel filtered, vertices included, for the cost of the filter stage
+		KinectFilterSettings filter;
+		filter.isEnabled = true;
+		filter.isVertexFiltered = true;
+		for (int faces = 0; faces <= BODY_COUNT; faces++)
+		{
+			run<ofxKinectHDFace>("hd face filtered", new SyntheticSource(faces), faces, BENCHMARK_FRAMES, KINECT_FACE_FEATURES_ALL, 0.f, filter);
+		}
+		// the synthetic triangles are not the sdk's mesh, so only the timings mean anything
+		runLod("hd face synthetic topology", new SyntheticSource(1), BENCHMARK_FRAMES, false);
+		runSetup("hd face", BENCHMARK_FRAMES / 30);
+		// several synthetic sensors on the group's shared pool, 1 is the single pipeline baseline
+		for (int sensors = 1; sensors <= 8; sensors *= 2)
+		{
+			runGroup(sensors, BENCHMARK_FRAMES);
+		}
+	}
+
+	csv.close();
+	microCsv.close();
+	ofExit();
+}
+
+//--------------------------------------------------------------
+void ofApp::update(){
+
+}
+
+// feeds frames through update() without a window, color is acquired but never uploaded
+template<class Face>
+BenchmarkResult ofApp::run(const std::string& name, KinectFrameSource* source, int faceCount, int frames, DWORD features, float budget, const KinectFilterSettings& filter, int requiredFrames){
+	BenchmarkResult result;
+	result.name = name;
+	result.faceCount = faceCount;
+	result.frameCount = 0;
+	result.framesPerSecond = 0.0;
+	result.allocationsPerFrame = 0.0;
+	result.qualityLevel = KINECT_QUALITY_FULL;
+
+	Face face;
+	face.setHeadless(true);
+	face.getStats().setEnabled(true);
+	setFeatures(face, features);
+	face.setRequiredFrames(requiredFrames);
+	face.setFilter(filter);
+	if (budget > 0.f)
+	{
+		KinectQualitySettings quality;
+		quality.isEnabled = true;
+		quality.budget = budget;
+		face.setQuality(quality);
+	}
+	face.setup(source);
+
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+	{
+		face.update();
+	}
+	face.getStats().reset();
+
+	unsigned long long allocations = allocationCount;
+	unsigned long long start = ofGetElapsedTimeMicros();
+	UINT64 firstFrame = face.getFrameSequence(KINECT_FRAME_BODY);
+	for (int i = 0; i < frames; i++)
+	{
+		face.update();
+	}
+	unsigned long long elapsed = ofGetElapsedTimeMicros() - start;
+
+	result.frameCount = face.getFrameSequence(KINECT_FRAME_BODY) - firstFrame;
+	if (result.frameCount > 0 && elapsed > 0)
+	{
+		result.framesPerSecond = result.frameCount * 1e6 / elapsed;
+		result.allocationsPerFrame = (double)(allocationCount - allocations) / result.frameCount;
+	}
+	result.qualityLevel = face.getQualityLevel();
+	result.stages = face.getStats().getSummary();
+	face.close();
+
+	report(result);
+	return result;
+}
+
+//--------------------------------------------------------------
+void ofApp::report(const BenchmarkResult& result){
+	if (result.frameCount == 0)
+	{
+		ofLogNotice("benchmark") << result.name << " : no frames";
+		return;
+	}
+
+	ofLogNotice("benchmark") << result.name << " x" << result.faceCount << " : "
+		<< ofToString(result.framesPerSecond, 1) << " fps, "
+		<< ofToString(result.allocationsPerFrame, 2) << " allocations per frame, quality level "
+		<< result.qualityLevel << "\n" << result.stages;
+	csv << result.name << "," << result.faceCount << "," << result.frameCount << ","
+		<< result.framesPerSecond << "," << result.allocationsPerFrame << "," << result.qualityLevel << "\n";
+}
+
+// gathers and projects the vertices of every lod level like the cpu path of packMesh does.
+// with the sdk's topology from a recording, the error of a level is the distance of each full model
+// vertex to the vertex standing in for it. the synthetic topology gets timings only
+void ofApp::runLod(const std::string& name, KinectFrameSource* source, int frames, bool hasRealTopology){
+	ofxKinectHDFace face;
+	face.setHeadless(true);
+	face.setup(source);
+
+	int slot = -1;
+	for (int i = 0; i < WARMUP_FRAMES || (slot < 0 && i < frames); i++)
+	{
+		face.update();
+		for (int j = 0; slot < 0 && j < BODY_COUNT; j++)
+		{
+			if (face.getIsFaceValid(j))slot = j;
+		}
+	}
+	const std::vector<CameraSpacePoint> vertices = face.getCameraVertices(slot);
+	if (slot < 0 || vertices.empty())
+	{
+		ofLogNotice("benchmark") << name << " lod : no face";
+		face.close();
+		return;
+	}
+
+	ofFile lodCsv("lod.csv", ofFile::WriteOnly);
+	lodCsv << "pipeline,level,vertices,triangles,vertices per second" << (hasRealTopology ? ",mean error mm,max error mm,max error px" : "") << "\n";
+
+	KinectColorProjection projection;
+	const float depth = face.getHeadPivot3D(slot).z;
+	std::vector<CameraSpacePoint> gathered;
+	std::vector<ColorSpacePoint> projected;
+	for (int l = 0; l < KINECT_MESH_LOD_COUNT; l++)
+	{
+		const KinectMeshLod& lod = face.getMeshLod(l);
+		const UINT32 count = lod.vertices.size();
+		gathered.resize(count);
+		projected.resize(count);
+
+		unsigned long long start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < frames; i++)
+		{
+			for (UINT32 j = 0; j < count; j++)
+			{
+				gathered[j] = vertices[lod.vertices[j]];
+			}
+			projection.project(gathered.data(), projected.data(), count);
+		}
+		unsigned long long elapsed = ofGetElapsedTimeMicros() - start;
+		double verticesPerSecond = elapsed > 0 ? (double)frames * count * 1e6 / elapsed : 0.0;
+		if (!hasRealTopology)
+		{
+			ofLogNotice("benchmark") << name << " lod " << l << " : " << count << " vertices, " << lod.indices.size() / 3 << " triangles, "
+				<< ofToString(verticesPerSecond / 1e6, 1) << "M vertices per second";
+			lodCsv << name << "," << l << "," << count << "," << lod.indices.size() / 3 << "," << verticesPerSecond << "\n";
+			continue;
+		}
+
+		double sum = 0.0;
+		float maxError = 0.f;
+		for (size_t j = 0; j < vertices.size(); j++)
+		{
+			const CameraSpacePoint& a = vertices[j];
+			const CameraSpacePoint& b = vertices[lod.vertices[lod.parents[j]]];
+			float error = ofVec3f(a.X - b.X, a.Y - b.Y, a.Z - b.Z).length();
+			sum += error;
+			maxError = MAX(maxError, error);
+		}
+		double meanError = sum / vertices.size();
+		float maxPixels = depth > 0.f ? maxError * projection.fx / depth : 0.f;
+
+		ofLogNotice("benchmark") << name << " lod " << l << " : " << count << " vertices, " << lod.indices.size() / 3 << " triangles, "
+			<< ofToString(verticesPerSecond / 1e6, 1) << "M vertices per second, error mean " << ofToString(meanError * 1000.0, 2)
+			<< " mm, max " << ofToString(maxError * 1000.f, 2) << " mm, " << ofToString(maxPixels, 1) << " px at " << ofToString(depth, 2) << " m";
+		lodCsv << name << "," << l << "," << count << "," << lod.indices.size() / 3 << "," << verticesPerSecond << ","
+			<< meanError * 1000.0 << "," << maxError * 1000.f << "," << maxPixels << "\n";
+	}
+	face.close();
+}
+
+// times a headless hd face setup() from the source's topology to the lod levels, and reports the topology
+// memory held once for all slots against the six per-slot copies it replaces. sizes go to setup.csv
+void ofApp::runSetup(const std::string& name, int iterations){
+	ofFile setupCsv("setup.csv", ofFile::WriteOnly);
+	setupCsv << "pipeline,iterations,us per setup,allocations per setup,triangles,shared index bytes,per slot index bytes,lod index bytes\n";
+
+	unsigned long long elapsed = 0;
+	unsigned long long allocations = 0;
+	size_t indexCount = 0;
+	size_t lodIndexCount = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		ofxKinectHDFace face;
+		face.setHeadless(true);
+		KinectFrameSource* source = recordingPath.size() ? (KinectFrameSource*)new KinectReplaySource(recordingPath, false, true) : new SyntheticSource(1);
+		unsigned long long before = allocationCount;
+		unsigned long long start = ofGetElapsedTimeMicros();
+		face.setup(source);
+		elapsed += ofGetElapsedTimeMicros() - start;
+		allocations += allocationCount - before;
+
+		std::shared_ptr<const std::vector<ofIndexType> > indices = face.getSharedIndices();
+		indexCount = indices ? indices->size() : 0;
+		lodIndexCount = 0;
+		for (int l = 1; l < KINECT_MESH_LOD_COUNT; l++)
+		{
+			lodIndexCount += face.getMeshLod(l).indices.size();
+		}
+		face.close();
+	}
+	if (indexCount == 0)
+	{
+		ofLogNotice("benchmark") << name << " setup : no topology";
+		return;
+	}
+	reportMicro(name + " setup", iterations, MAX(elapsed, 1ULL), allocations, 1.0, "setups/s");
+
+	const size_t sharedBytes = indexCount * sizeof(ofIndexType);
+	const size_t perSlotBytes = sharedBytes * BODY_COUNT;
+	const size_t lodBytes = lodIndexCount * sizeof(ofIndexType);
+	ofLogNotice("benchmark") << name << " topology : " << indexCount / 3 << " triangles, " << ofToString(sharedBytes / 1024.0, 1)
+		<< " KB shared against " << ofToString(perSlotBytes / 1024.0, 1) << " KB per slot, " << ofToString(lodBytes / 1024.0, 1) << " KB of lod indices";
+	setupCsv << name << "," << iterations << "," << (double)elapsed / iterations << "," << (double)allocations / iterations << ","
+		<< indexCount / 3 << "," << sharedBytes << "," << perSlotBytes << "," << lodBytes << "\n";
+}
+
+// two faces per sensor, seen from sensors 0.1 m apart so the merge clusters every view of a face
+void ofApp::runGroup(int sensorCount, int frames){
+	KinectFaceGroup group;
+	group.setHeadless(true);
+	group.setup();
+	for (int s = 0; s < sensorCount; s++)
+	{
+		ofMatrix4x4 extrinsics;
+		extrinsics.makeTranslationMatrix(s * 0.1f, 0.f, 0.f);
+		group.addSource(new SyntheticSource(2), extrinsics);
+	}
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+	{
+		group.update();
+	}
+
+	BenchmarkResult result;
+	result.name = "group " + ofToString(sensorCount) + " sensors";
+	result.faceCount = 2;
+	result.frameCount = 0;
+	result.framesPerSecond = 0.0;
+	result.allocationsPerFrame = 0.0;
+	result.qualityLevel = KINECT_QUALITY_FULL;
+
+	unsigned long long allocations = allocationCount;
+	unsigned long long start = ofGetElapsedTimeMicros();
+	for (int i = 0; i < frames; i++)
+	{
+		if (group.update() > 0)result.frameCount++;
+	}
+	unsigned long long elapsed = ofGetElapsedTimeMicros() - start;
+	if (result.frameCount > 0 && elapsed > 0)
+	{
+		result.framesPerSecond = result.frameCount * 1e6 / elapsed;
+		result.allocationsPerFrame = (double)(allocationCount - allocations) / result.frameCount;
+	}
+	result.stages = ofToString(group.getFaces().size()) + " merged faces, " + ofToString(group.getSensorCount()) + " sensors on "
+		+ ofToString(MAX((int)std::thread::hardware_concurrency(), 1)) + " workers";
+	group.close();
+
+	report(result);
+}
+
+// processes the whole recording offline with 1, 2, 4 ... threads up to the hardware threads,
+// every run has to produce the same columns as the single threaded one
+void ofApp::runBatch(const std::string& path){
+	KinectSourceMode mode = KINECT_SOURCE_FACE;
+	KinectBatchProcessor reference;
+	KinectBatchSettings settings;
+	settings.threadCount = 1;
+	reference.setSettings(settings);
+	if (!reference.process(path, mode))
+	{
+		mode = KINECT_SOURCE_HD_FACE;
+		if (!reference.process(path, mode))
+		{
+			ofLogNotice("benchmark") << "batch : could not open " << path;
+			return;
+		}
+	}
+	reference.save("batch.okfc");
+	ofLogNotice("benchmark") << "batch : " << reference.getFrameCount() << " frames, " << reference.getColumns().size()
+		<< " faces written to batch.okfc\n" << reference.getMetrics().getSummary();
+
+	ofFile batchCsv("batch.csv", ofFile::WriteOnly);
+	batchCsv << "threads,frames,seconds,fps,speedup,identical\n";
+	const int hardwareThreads = MAX((int)std::thread::hardware_concurrency(), 1);
+	for (int threads = 1; threads <= hardwareThreads; threads = threads < hardwareThreads ? MIN(threads * 2, hardwareThreads) : threads + 1)
+	{
+		KinectBatchProcessor batch;
+		settings.threadCount = threads;
+		batch.setSettings(settings);
+		bool isProcessed = batch.process(path, mode);
+
+		// a failed chunk leaves rows out, which never counts as the same output
+		const KinectBatchColumns& a = batch.getColumns();
+		const KinectBatchColumns& b = reference.getColumns();
+		bool isIdentical = isProcessed && a.frame == b.frame && a.slot == b.slot && a.yaw == b.yaw && a.pitch == b.pitch && a.roll == b.roll
+			&& a.colorX == b.colorX && a.colorY == b.colorY && a.pivotZ == b.pivotZ;
+		double seconds = batch.getElapsedSeconds();
+		double fps = seconds > 0.0 ? batch.getFrameCount() / seconds : 0.0;
+		double speedup = seconds > 0.0 ? reference.getElapsedSeconds() / seconds : 0.0;
+
+		ofLogNotice("benchmark") << "batch x" << threads << " : " << ofToString(fps, 0) << " fps, "
+			<< ofToString(speedup, 2) << "x" << (isIdentical ? "" : ", output differs");
+		batchCsv << threads << "," << batch.getFrameCount() << "," << seconds << "," << fps << "," << speedup << "," << isIdentical << "\n";
+	}
+}
+
+// amount is what one iteration processes, reported per second in unit
+void ofApp::reportMicro(const std::string& name, int iterations, unsigned long long elapsed, unsigned long long allocations, double amount, const std::string& unit){
+	if (iterations <= 0 || elapsed == 0)
+	{
+		ofLogNotice("benchmark") << name << " : not measured";
+		return;
+	}
+
+	double micros = (double)elapsed / iterations;
+	double throughput = amount * iterations * 1e6 / elapsed;
+	double allocationsPerIteration = (double)allocations / iterations;
+	ofLogNotice("benchmark") << name << " : " << ofToString(micros, 1) << " us, " << ofToString(throughput, 1) << " " << unit
+		<< ", " << ofToString(allocationsPerIteration, 2) << " allocations";
+	microCsv << name << "," << iterations << "," << micros << "," << throughput << "," << unit << "," << allocationsPerIteration << "\n";
+}
+
+// one 1920x1080 frame per iteration, converted like getColorPixels() and replay do,
+// next to a plain copy of the rgba result for scale
+void ofApp::runYuy2(int iterations){
+	const int pixelCount = 1920 * 1080;
+	std::vector<unsigned char> yuy2(pixelCount * 2);
+	std::vector<unsigned char> rgba(pixelCount * 4);
+	std::vector<unsigned char> copy(pixelCount * 4);
+	for (size_t i = 0; i < yuy2.size(); i++)
+	{
+		yuy2[i] = (unsigned char)(i * 7 + i / 3840);
+	}
+
+	KinectConvertYuy2ToRgba(yuy2.data(), rgba.data(), pixelCount);
+	unsigned long long allocations = allocationCount;
+	unsigned long long start = ofGetElapsedTimeMicros();
+	for (int i = 0; i < iterations; i++)
+	{
+		KinectConvertYuy2ToRgba(yuy2.data(), rgba.data(), pixelCount);
+	}
+	reportMicro("yuy2 to rgba 1080p", iterations, ofGetElapsedTimeMicros() - start, allocationCount - allocations, pixelCount / 1e6, "Mpixels/s");
+
+	allocations = allocationCount;
+	start = ofGetElapsedTimeMicros();
+	for (int i = 0; i < iterations; i++)
+	{
+		memcpy(copy.data(), rgba.data(), copy.size());
+	}
+	reportMicro("rgba copy 1080p", iterations, ofGetElapsedTimeMicros() - start, allocationCount - allocations, pixelCount / 1e6, "Mpixels/s");
+}
+
+// the 1347 vertices of one hd face to color space per iteration: batched with sse2 where the target has it,
+// batched scalar, and one call per point like the old MapCameraPointToColorSpace loop. the sensor's own
+// mapper needs a connected kinect and is not timed here
+void ofApp::runProjection(int frames){
+	ofxKinectHDFace face;
+	face.setHeadless(true);
+	face.setup(new SyntheticSource(1));
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+	{
+		face.update();
+	}
+	const std::vector<CameraSpacePoint> vertices = face.getCameraVertices(0);
+	face.close();
+
+	const UINT count = vertices.size();
+	if (count == 0)
+	{
+		ofLogNotice("benchmark") << "projection : no vertices";
+		return;
+	}
+
+	KinectColorProjection projection;
+	std::vector<ColorSpacePoint> batched(count);
+	std::vector<ColorSpacePoint> scalar(count);
+	for (int pass = 0; pass < 3; pass++)
+	{
+		std::vector<ColorSpacePoint>& projected = pass == 0 ? batched : scalar;
+		unsigned long long allocations = allocationCount;
+		unsigned long long start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < frames; i++)
+		{
+			switch (pass)
+			{
+			case 0:
+				projection.project(vertices.data(), projected.data(), count);
+				break;
+			case 1:
+				projection.projectScalar(vertices.data(), projected.data(), count);
+				break;
+			default:
+				for (UINT j = 0; j < count; j++)
+				{
+					projection.project(&vertices[j], &projected[j], 1);
+				}
+				break;
+			}
+		}
+		unsigned long long elapsed = ofGetElapsedTimeMicros() - start;
+
+		static const char* names[] = { "project 1347 vertices batched", "project 1347 vertices scalar", "project 1347 vertices per point" };
+		reportMicro(names[pass], frames, MAX(elapsed, 1ULL), allocationCount - allocations, count / 1e6, "Mvertices/s");
+	}
+
+	bool isIdentical = memcmp(batched.data(), scalar.data(), sizeof(ColorSpacePoint) * count) == 0;
+	ofLogNotice("benchmark") << "projection batched and scalar " << (isIdentical ? "agree" : "differ");
+}
+
+// reads the vertices of six faces per frame through each accessor, the fill overloads
+// must not allocate once the caller's buffers have grown
+void ofApp::runAccessors(int frames){
+	ofxKinectHDFace face;
+	face.setHeadless(true);
+	face.setup(new SyntheticSource(BODY_COUNT));
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+	{
+		face.update();
+	}
+
+	std::vector<ofPoint> points;
+	KinectVertexArrays arrays;
+	double sum = 0.0;
+	const double vertices = (double)face.getCameraVertices(0).size() * BODY_COUNT;
+	for (int pass = 0; pass < 5; pass++)
+	{
+		unsigned long long elapsed = 0;
+		unsigned long long allocations = 0;
+		for (int i = 0; i < frames; i++)
+		{
+			face.update();
+			unsigned long long before = allocationCount;
+			unsigned long long start = ofGetElapsedTimeMicros();
+			for (int j = 0; j < BODY_COUNT; j++)
+			{
+				switch (pass)
+				{
+				case 0:
+					sum += face.getVertices3D(j).size();
+					break;
+				case 1:
+					face.getVertices3D(j, points);
+					sum += points.size();
+					break;
+				case 2:
+					face.getVertices3D(j, arrays);
+					sum += arrays.x.size();
+					break;
+				case 3:
+					face.getVertices2D(j, points);
+					sum += points.size();
+					break;
+				default:
+					sum += face.getCameraVertices(j).size();
+					break;
+				}
+			}
+			elapsed += ofGetElapsedTimeMicros() - start;
+			allocations += allocationCount - before;
+		}
+
+		static const char* names[] = { "getVertices3D by value", "getVertices3D into vector", "getVertices3D into arrays", "getVertices2D into vector", "getCameraVertices" };
+		reportMicro(std::string(names[pass]) + " x6", frames, MAX(elapsed, 1ULL), allocations, vertices / 1e6, "Mvertices/s");
+	}
+	face.close();
+	ofLogVerbose("benchmark") << "accessor checksum " << sum;
+}
+
+// round trips a moving synthetic face through the vertex codec, with key frames every 30 frames
+// like the publisher and with key frames only like the recorder. sizes and the largest error go to codec.csv
+void ofApp::runCodec(int frames){
+	ofxKinectHDFace face;
+	face.setHeadless(true);
+	face.setup(new SyntheticSource(1));
+	for (int i = 0; i < WARMUP_FRAMES; i++)
+	{
+		face.update();
+	}
+
+	// the frames are captured first so only the codec is timed
+	std::vector<std::vector<CameraSpacePoint> > vertexFrames(frames);
+	std::vector<CameraSpacePoint> pivots(frames);
+	for (int i = 0; i < frames; i++)
+	{
+		face.update();
+		vertexFrames[i] = face.getCameraVertices(0);
+		ofPoint pivot = face.getHeadPivot3D(0);
+		pivots[i].X = pivot.x;
+		pivots[i].Y = pivot.y;
+		pivots[i].Z = pivot.z;
+	}
+	face.close();
+
+	const UINT32 count = vertexFrames.empty() ? 0 : vertexFrames[0].size();
+	if (count == 0)
+	{
+		ofLogNotice("benchmark") << "vertex codec : no vertices";
+		return;
+	}
+
+	ofFile codecCsv("codec.csv", ofFile::WriteOnly);
+	codecCsv << "key frame interval,frames,raw bytes,mean block bytes,ratio,max error um\n";
+	const double rawBytes = sizeof(CameraSpacePoint) * count;
+	const int intervals[] = { 30, 1 };
+	for (int n = 0; n < 2; n++)
+	{
+		KinectVertexEncoder encoder(intervals[n]);
+		std::vector<std::vector<BYTE> > blocks(frames);
+		unsigned long long allocations = allocationCount;
+		unsigned long long start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < frames; i++)
+		{
+			encoder.encode(pivots[i], vertexFrames[i].data(), count, blocks[i]);
+		}
+		reportMicro("vertex encode key every " + ofToString(intervals[n]), frames, ofGetElapsedTimeMicros() - start,
+			allocationCount - allocations, rawBytes / 1e6, "MB/s raw");
+
+		KinectVertexDecoder decoder;
+		std::vector<CameraSpacePoint> decoded(count);
+		float maxError = 0.f;
+		double blockBytes = 0.0;
+		unsigned long long elapsed = 0;
+		allocations = allocationCount;
+		for (int i = 0; i < frames; i++)
+		{
+			start = ofGetElapsedTimeMicros();
+			bool isDecoded = decoder.decode(blocks[i].data(), blocks[i].size(), decoded.data(), count);
+			elapsed += ofGetElapsedTimeMicros() - start;
+			blockBytes += blocks[i].size();
+			for (UINT32 j = 0; isDecoded && j < count; j++)
+			{
+				maxError = MAX(maxError, fabsf(decoded[j].X - vertexFrames[i][j].X));
+				maxError = MAX(maxError, fabsf(decoded[j].Y - vertexFrames[i][j].Y));
+				maxError = MAX(maxError, fabsf(decoded[j].Z - vertexFrames[i][j].Z));
+			}
+		}
+		reportMicro("vertex decode key every " + ofToString(intervals[n]), frames, MAX(elapsed, 1ULL),
+			allocationCount - allocations, rawBytes / 1e6, "MB/s raw");
+
+		double meanBytes = blockBytes / frames;
+		ofLogNotice("benchmark") << "vertex codec key every " << intervals[n] << " : " << ofToString(meanBytes / 1024.0, 1) << " KB per block against "
+			<< ofToString(rawBytes / 1024.0, 1) << " KB raw, max error " << ofToString(maxError * 1e6f, 1) << " um";
+		codecCsv << intervals[n] << "," << frames << "," << rawBytes << "," << meanBytes << "," << rawBytes / meanBytes << "," << maxError * 1e6f << "\n";
+	}
+}
+
+// the one euro filter alone on six faces of 1347 vertices, as isVertexFiltered runs it per frame
+void ofApp::runFilter(int frames){
+	const int channels = 1347 * 3;
+	KinectOneEuroFilter filters[BODY_COUNT];
+	std::vector<float> values[BODY_COUNT];
+	for (int j = 0; j < BODY_COUNT; j++)
+	{
+		filters[j].setup(channels, 1000.f);
+		values[j].resize(channels);
+	}
+
+	KinectFilterSettings settings;
+	settings.isEnabled = true;
+	settings.isVertexFiltered = true;
+	unsigned long long elapsed = 0;
+	unsigned long long allocations = allocationCount;
+	for (int i = 0; i < frames; i++)
+	{
+		const double time = i / 30.0;
+		for (int j = 0; j < BODY_COUNT; j++)
+		{
+			for (int k = 0; k < channels; k++)
+			{
+				values[j][k] = 0.1f * sinf(time + k * 0.01f + j) + (k % 3 == 2 ? 1.5f : 0.f);
+			}
+		}
+		unsigned long long start = ofGetElapsedTimeMicros();
+		for (int j = 0; j < BODY_COUNT; j++)
+		{
+			filters[j].update(values[j].data(), time, settings);
+		}
+		elapsed += ofGetElapsedTimeMicros() - start;
+	}
+	reportMicro("one euro filter 6 x 1347 vertices", frames, MAX(elapsed, 1ULL), allocationCount - allocations,
+		(double)channels * BODY_COUNT / 1e6, "Mchannels/s");
+}
+
+// publishes two synthetic hd faces per frame over udp, osc and the shared memory ring and decodes
+// them again on this host. every decoded vertex is compared with the one that was sent, coded
+// vertices have to be within half a quantization step, raw ones identical. results go to loopback.csv
+void ofApp::runLoopback(int frames){
+	ofFile loopbackCsv("loopback.csv", ofFile::WriteOnly);
+	loopbackCsv << "transport,frames,faces sent,faces decoded,faces without vertices,max error um\n";
+
+	static const char* names[] = { "udp", "osc", "shared memory" };
+	for (int transport = 0; transport < 3; transport++)
+	{
+		ofxKinectHDFace face;
+		face.setHeadless(true);
+		face.setup(new SyntheticSource(2));
+		for (int i = 0; i < WARMUP_FRAMES; i++)
+		{
+			face.update();
+		}
+
+		KinectFacePublisher publisher;
+		KinectFaceReceiver receiver;
+		bool isReady = true;
+		if (transport < 2)
+		{
+			isReady = receiver.setup(LOOPBACK_PORT, transport == 1) && publisher.setup("127.0.0.1", LOOPBACK_PORT, transport == 1);
+		}
+		else
+		{
+			const std::string name = "ofxKinectFaceLoopback" + ofToString(ofGetElapsedTimeMicros());
+			isReady = publisher.setupSharedMemory(name) && receiver.setupSharedMemory(name);
+		}
+		if (!isReady)
+		{
+			ofLogNotice("benchmark") << "loopback " << names[transport] << " : could not open";
+			face.close();
+			continue;
+		}
+
+		int sent = 0;
+		int decoded = 0;
+		int withoutVertices = 0;
+		float maxError = 0.f;
+		unsigned long long elapsed = 0;
+		unsigned long long allocations = 0;
+		KinectReceivedFace received;
+		std::vector<KinectReceivedFace> receivedFrame;
+		for (int i = 0; i < frames; i++)
+		{
+			face.update();
+			unsigned long long before = allocationCount;
+			unsigned long long start = ofGetElapsedTimeMicros();
+			publisher.publish(face);
+			elapsed += ofGetElapsedTimeMicros() - start;
+			allocations += allocationCount - before;
+			for (int j = 0; j < BODY_COUNT; j++)
+			{
+				if (face.getIsFaceTracked(j))sent++;
+			}
+
+			receivedFrame.clear();
+			if (transport < 2)
+			{
+				while (receiver.receive(received))
+				{
+					receivedFrame.push_back(received);
+				}
+			}
+			else
+			{
+				receiver.receiveShared(receivedFrame);
+			}
+
+			for (size_t n = 0; n < receivedFrame.size(); n++)
+			{
+				const KinectReceivedFace& result = receivedFrame[n];
+				if (result.header.slot >= BODY_COUNT)continue;
+
+				decoded++;
+				const std::vector<CameraSpacePoint>& vertices = face.getCameraVertices(result.header.slot);
+				if (result.vertices.size() != vertices.size())
+				{
+					withoutVertices++;
+					continue;
+				}
+				for (size_t k = 0; k < vertices.size(); k++)
+				{
+					maxError = MAX(maxError, fabsf(result.vertices[k].X - vertices[k].X));
+					maxError = MAX(maxError, fabsf(result.vertices[k].Y - vertices[k].Y));
+					maxError = MAX(maxError, fabsf(result.vertices[k].Z - vertices[k].Z));
+				}
+			}
+		}
+		face.close();
+
+		reportMicro("publish 2 hd faces " + std::string(names[transport]), frames, MAX(elapsed, 1ULL), allocations, 1.0, "frames/s");
+		ofLogNotice("benchmark") << "loopback " << names[transport] << " : " << decoded << " of " << sent << " faces decoded, "
+			<< withoutVertices << " without vertices, max error " << ofToString(maxError * 1e6f, 1) << " um";
+		loopbackCsv << names[transport] << "," << frames << "," << sent << "," << decoded << "," << withoutVertices << "," << maxError * 1e6f << "\n";
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxKinectFace.h"
+#include "ofxKinectFaceBatch.h"
+#include "ofxKinectFacePublisher.h"
+#include "ofxKinectFaceGroup.h"
+
+extern std::atomic<unsigned long long> allocationCount;
+
+struct BenchmarkResult
+{
+	std::string name;
+	int faceCount;
+	int frameCount;
+	double framesPerSecond;
+	double allocationsPerFrame;
+	int qualityLevel; // KinectQualityLevel at the end of the run
+	std::string stages;
+};
+
+class ofApp : public ofBaseApp{
+public:
+	void setup();
+	void update();
+
+	std::string recordingPath;
+
+private:
+	template<class Face>
+	BenchmarkResult run(const std::string& name, KinectFrameSource* source, int faceCount, int frames, DWORD features = KINECT_FACE_FEATURES_ALL, float budget = 0.f,
+		const KinectFilterSettings& filter = KinectFilterSettings(), int requiredFrames = KINECT_FRAME_ALL);
+	void report(const BenchmarkResult& result);
+	void runLod(const std::string& name, KinectFrameSource* source, int frames, bool hasRealTopology);
+	void runSetup(const std::string& name, int iterations);
+	void runGroup(int sensorCount, int frames);
+	void runBatch(const std::string& path);
+	// single operations timed outside the pipelines, written to micro.csv
+	void reportMicro(const std::string& name, int iterations, unsigned long long elapsed, unsigned long long allocations, double amount, const std::string& unit);
+	void runYuy2(int iterations);
+	void runProjection(int frames);
+	void runAccessors(int frames);
+	void runCodec(int frames);
+	void runFilter(int frames);
+	void runLoopback(int frames);
+
+	ofFile csv;
+	ofFile microCsv;
+};
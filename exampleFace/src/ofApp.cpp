@@ -5,6 +5,7 @@ void ofApp::setup(){
 	ofSetFrameRate(60);
 
 	face = new ofxKinectFace();
+	face->getStats().setEnabled(true);
 	face->setup();
 }
 
@@ -22,6 +23,7 @@ void ofApp::draw(){
 	ofPopMatrix();
 
 	ofSetColor(ofColor::white);
+	ofDrawBitmapString(face->getStats().getSummary(), 20, 20);
 	ofDrawBitmapString(ofToString(ofGetFrameRate()), 20, ofGetHeight()-20);
 }
 
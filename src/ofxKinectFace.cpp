@@ -12,18 +12,6 @@
 
 static const int COLOR_WIDTH = 1920;
 static const int COLOR_HEIGHT = 1080;
-static const DWORD FACE_FRAME_FEATURES = 
-	FaceFrameFeatures::FaceFrameFeatures_BoundingBoxInColorSpace
-	| FaceFrameFeatures::FaceFrameFeatures_PointsInColorSpace
-	| FaceFrameFeatures::FaceFrameFeatures_RotationOrientation
-	| FaceFrameFeatures::FaceFrameFeatures_Happy
-	| FaceFrameFeatures::FaceFrameFeatures_RightEyeClosed
-	| FaceFrameFeatures::FaceFrameFeatures_LeftEyeClosed
-	| FaceFrameFeatures::FaceFrameFeatures_MouthOpen
-	| FaceFrameFeatures::FaceFrameFeatures_MouthMoved
-	| FaceFrameFeatures::FaceFrameFeatures_LookingAway
-	| FaceFrameFeatures::FaceFrameFeatures_Glasses
-	| FaceFrameFeatures::FaceFrameFeatures_FaceEngagement;
 static const ofColor* FACE_COLOR[] =
 {
 	&ofColor::red,
@@ -34,161 +22,472 @@ static const ofColor* FACE_COLOR[] =
 	&ofColor::pink,
 };
 
+// unpacks yuy2 stored as luminance/alpha texels, even texels hold u and odd texels hold v
+static const std::string YUY2_FRAGMENT_SHADER =
+	"#version 120\n"
+	"#extension GL_ARB_texture_rectangle : enable\n"
+	"uniform sampler2DRect tex0;\n"
+	"void main()\n"
+	"{\n"
+	"	float x = floor(gl_TexCoord[0].s);\n"
+	"	vec2 pos = vec2(x + 0.5, gl_TexCoord[0].t);\n"
+	"	float isOdd = mod(x, 2.0);\n"
+	"	vec4 texel = texture2DRect(tex0, pos);\n"
+	"	vec4 pair = texture2DRect(tex0, pos + vec2(1.0 - 2.0 * isOdd, 0.0));\n"
+	"	float u = mix(texel.a, pair.a, isOdd) - 0.5;\n"
+	"	float v = mix(pair.a, texel.a, isOdd) - 0.5;\n"
+	"	vec3 rgb = texel.rrr + vec3(1.402 * v, -0.344 * u - 0.714 * v, 1.772 * u);\n"
+	"	gl_FragColor = vec4(rgb, 1.0) * gl_Color;\n"
+	"}\n";
+
+// projects camera space vertices with the pinhole fit of KinectColorProjection
+static const std::string MESH_VERTEX_SHADER =
+	"#version 120\n"
+	"uniform vec2 focal;\n"
+	"uniform vec2 center;\n"
+	"uniform vec2 offset;\n"
+	"void main()\n"
+	"{\n"
+	"	vec3 p = gl_Vertex.xyz;\n"
+	"	vec2 color = vec2(center.x + focal.x * (p.x + offset.x) / p.z, center.y - focal.y * (p.y + offset.y) / p.z);\n"
+	"	gl_Position = p.z > 0.0 ? gl_ModelViewProjectionMatrix * vec4(color, 0.0, 1.0) : vec4(0.0, 0.0, 2.0, 1.0);\n"
+	"	gl_FrontColor = gl_Color;\n"
+	"}\n";
+
+static const std::string MESH_FRAGMENT_SHADER =
+	"#version 120\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = gl_Color;\n"
+	"}\n";
+
 KinectBase::KinectBase()
+	: source(nullptr)
+	, requiredFrames(KINECT_FRAME_ALL)
+	, activeCount(0)
+	, isBodyPending(false)
+	, bodyTime(0)
+	, isThreaded(false)
+	, isExternallyDriven(false)
+	, isColorYuy2(false)
+	, isHeadless(false)
+	, hasSnapshot(false)
 {
-	color = new ofImage();
-	color->allocate(COLOR_WIDTH, COLOR_HEIGHT, OF_IMAGE_COLOR_ALPHA);
 	for (int i = 0; i < BODY_COUNT; i++)
 	{
-		isFaceValid[i] = false;
+		trackingIds[i] = 0;
+		activeSlots[i] = 0;
+		isSlotScheduled[i] = true;
+		filteredIds[i] = 0;
+	}
+	for (int s = 0; s < STREAM_COUNT; s++)
+	{
+		for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
+		{
+			frameSequence[b][s] = 0;
+		}
+		acquiredSequence[s] = seenSequence[s] = 0;
+		isStreamNew[s] = false;
+	}
+	for (int r = 0; r < KINECT_FACE_REJECTION_COUNT; r++)
+	{
+		rejectionCounts[r] = 0;
+	}
+	for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
+	{
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			faceRotation[b][i].x = faceRotation[b][i].y = faceRotation[b][i].z = faceRotation[b][i].w = 0.f;
+			isFaceValid[b][i] = false;
+			isFaceTracked[b][i] = false;
+			slotTrackingIds[b][i] = 0;
+			personIds[b][i] = 0;
+		}
+		trackedCount[b] = 0;
+		frameTime[b] = 0;
+		isColorSkipped[b] = false;
 	}
 }
 
 KinectBase::~KinectBase()
 {
 	close();
+	delete source;
 }
 
-bool KinectBase::setup()
+// takes ownership of source
+bool KinectBase::setup(KinectFrameSource* source, KinectSourceMode mode, bool threaded)
 {
-	HRESULT hr = GetDefaultKinectSensor(&sensor);
-
-	if(sensor)
+	close();
+	delete this->source;
+
+	this->source = source;
+	isThreaded = threaded && !isExternallyDriven;
+	isBodyPending = false;
+	persons.clear();
+	quality.reset();
+	if (source)
 	{
-		IColorFrameSource*	colorFrameSource = nullptr;
-		IBodyFrameSource*	bodyFrameSource = nullptr;
+		source->setStats(&stats);
+	}
 
-		hr = sensor->Open();
+	// keep the sensor's native yuy2 (2 bytes per pixel) and convert it while drawing,
+	// the programmable renderer falls back to rgba converted by the sdk
+	isColorYuy2 = (requiredFrames & KINECT_FRAME_COLOR) && (isHeadless || !ofIsGLProgrammableRenderer());
+	if (isColorYuy2 && !isHeadless)
+	{
+		isColorYuy2 = yuy2Shader.setupShaderFromSource(GL_FRAGMENT_SHADER, YUY2_FRAGMENT_SHADER) && yuy2Shader.linkProgram();
+	}
 
-		if (SUCCEEDED(hr))
+	// color buffers and texture only exist when the color stream is consumed
+	if (requiredFrames & KINECT_FRAME_COLOR)
+	{
+		int channels = isColorYuy2 ? 2 : 4;
+		for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
 		{
-			hr = sensor->get_ColorFrameSource(&colorFrameSource);
+			colorPixels[b].allocate(COLOR_WIDTH, COLOR_HEIGHT, channels);
 		}
-
-		if (SUCCEEDED(hr))
+		if (!isHeadless)
 		{
-			hr = colorFrameSource->OpenReader(&colorFrameReader);
+			colorTexture.allocate(COLOR_WIDTH, COLOR_HEIGHT, isColorYuy2 ? GL_LUMINANCE_ALPHA : GL_RGBA, true);
+			colorTexture.setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
 		}
+	}
 
-		if (SUCCEEDED(hr))
-		{
-			hr = sensor->get_BodyFrameSource(&bodyFrameSource);
-		}
+	return source && source->open(mode, requiredFrames | KINECT_FRAME_BODY);
+}
 
-		if (SUCCEEDED(hr))
-		{
-			hr = bodyFrameSource->OpenReader(&bodyFrameReader);
-		}
+// selects the streams to consume (KinectFrameType flags), call before setup()
+void KinectBase::setRequiredFrames(int frames)
+{
+	requiredFrames = frames;
+}
 
-		if (SUCCEEDED(hr)){
-			hr = sensor->get_CoordinateMapper( &coordinateMapper );
-		}
+// skips every texture, shader and vertex buffer so processing runs without a gl context,
+// drawing does nothing, call before setup()
+void KinectBase::setHeadless(bool isHeadless)
+{
+	this->isHeadless = isHeadless;
+}
 
-		SafeRelease(colorFrameSource);
-		SafeRelease(bodyFrameSource);
-	}
+void KinectBase::setExternallyDriven(bool isExternal)
+{
+	isExternallyDriven = isExternal;
+}
+
+bool KinectBase::getExternallyDriven()
+{
+	return isExternallyDriven;
+}
 
-	return SUCCEEDED(hr);
+bool KinectBase::acquireExternalFrame()
+{
+	return isExternallyDriven && source && source->waitForFrame(0) && acquireFrame();
 }
 
 void KinectBase::update()
 {
-	if(!colorFrameReader || !bodyFrameReader)
+	// readers are only touched once something arrived
+	if (!isThreaded && !isExternallyDriven && source && source->waitForFrame(0))
 	{
-		return;
+		acquireFrame();
 	}
 
-	IColorFrame* colorFrame = NULL;
-	HRESULT hr = colorFrameReader->AcquireLatestFrame(&colorFrame);
-
-	if(SUCCEEDED(hr))
+	// only swaps indices, never waits on the sensor
+	bool isNew = buffers.swap();
+	if (isNew)
 	{
-		INT64 nTime = 0;
-		hr = colorFrame->get_RelativeTime(&nTime);
+		stats.recordLatency(frameTime[buffers.getFront()], ofGetElapsedTimeMicros());
+	}
+	for (int s = 0; s < STREAM_COUNT; s++)
+	{
+		isStreamNew[s] = isNew && frameSequence[buffers.getFront()][s] != seenSequence[s];
+		seenSequence[s] = frameSequence[buffers.getFront()][s];
+	}
 
-		IFrameDescription* description = NULL;
-		int width = 0;
-		int height = 0;
-		ColorImageFormat imageFormat = ColorImageFormat_None;
-		BYTE *pixels;
-		UINT bufferSize = 0;
+	if (isStreamNew[STREAM_COLOR] && colorTexture.isAllocated())
+	{
+		KinectScopedTimer timer(&stats, KINECT_STAGE_UPLOAD);
+		colorTexture.loadData(colorPixels[buffers.getFront()]);
+	}
+}
 
-		if (SUCCEEDED(hr))
+// runs until close() or until the source is exhausted, a wait that returned
+// without a complete frame yields instead of spinning
+void KinectBase::threadedFunction()
+{
+	while (isThreadRunning())
+	{
+		if (source->isExhausted())
 		{
-			hr = colorFrame->get_FrameDescription(&description);
+			ofLogVerbose("KinectBase") << "source exhausted, worker stops";
+			break;
 		}
-
-		if (SUCCEEDED(hr))
+		if (!source->waitForFrame(100) || !acquireFrame())
 		{
-			hr = description->get_Width(&width);
+			yield();
 		}
+	}
+}
+
+// acquires color and faces into the back buffer and publishes it
+bool KinectBase::acquireFrame()
+{
+	if (!source)
+	{
+		return false;
+	}
 
-		if (SUCCEEDED(hr))
+	// faces are processed per color frame, or per body frame when color is not consumed
+	KinectScopedTimer timer(&stats, KINECT_STAGE_FRAME);
+	const unsigned long long start = ofGetElapsedTimeMicros();
+	const bool isSkipped = quality.isColorSkipped();
+	INT64 time = 0;
+	bool hasColor = false;
+	bool hasBodies = false;
+	{
+		KinectScopedTimer timer(&stats, KINECT_STAGE_ACQUIRE);
+		if (requiredFrames & KINECT_FRAME_COLOR)
 		{
-			hr = description->get_Height(&height);
+			hasColor = isSkipped ? source->skipColor(time) : source->acquireColor(colorPixels[buffers.getBack()], time);
 		}
+		hasBodies = source->acquireBodies(trackingIds, time);
+	}
+	// a body frame that arrives ahead of its color frame is applied with the color frame
+	if (hasBodies)
+	{
+		isBodyPending = true;
+		bodyTime = time;
+	}
+	if ((requiredFrames & KINECT_FRAME_COLOR) ? !hasColor : !hasBodies)
+	{
+		return false;
+	}
+
+	hasBodies = isBodyPending;
+	updateActiveSlots(hasBodies, bodyTime);
+	isBodyPending = false;
+	bool hasFaces = processFaces();
+	keepInactiveFaces();
+	if (hasFaces)
+	{
+		filterFaces(time);
+	}
+	// after processFaces(), a fitted shape may have merged a returning person
+	persons.getPersonIds(personIds[buffers.getBack()]);
+
+	// count arrivals per stream so consumers can skip unchanged results,
+	// a skipped color frame is never uploaded
+	isColorSkipped[buffers.getBack()] = hasColor && isSkipped;
+	if (isColorSkipped[buffers.getBack()])stats.count(KINECT_COUNT_COLOR_SKIPPED);
+	if (hasColor && !isSkipped)acquiredSequence[STREAM_COLOR]++;
+	if (hasBodies)acquiredSequence[STREAM_BODY]++;
+	if (hasFaces)acquiredSequence[STREAM_FACE]++;
+	memcpy(frameSequence[buffers.getBack()], acquiredSequence, sizeof(acquiredSequence));
+	frameTime[buffers.getBack()] = time;
+	updateSnapshot(time);
+	quality.endFrame(ofGetElapsedTimeMicros() - start);
+
+	buffers.publish();
+	return true;
+}
+
+// smooths the faces updated this frame, a slot's filters restart when it changes its body
+void KinectBase::filterFaces(INT64 time)
+{
+	const int b = buffers.getBack();
+	const double seconds = time * 1e-7;
 
-		if (SUCCEEDED(hr))
+	// smoothing is per body, not per person. a returning body gets a new person id until its shape
+	// is fitted, and whatever was filtered before it left is stale by then
+	KinectScopedTimer timer(&stats, KINECT_STAGE_FILTER);
+	ofScopedLock lock(filterMutex);
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		const KinectFilterSettings& settings = filterSettings[i];
+		if (filteredIds[i] != trackingIds[i] || !settings.isEnabled)
 		{
-			hr = colorFrame->get_RawColorImageFormat(&imageFormat);
+			filteredIds[i] = trackingIds[i];
+			rotationFilters[i].reset();
+			resetFilter(i);
 		}
+		if(!settings.isEnabled || !isFaceValid[b][i] || !isSlotScheduled[i])continue;
+
+		rotationFilters[i].update(&faceRotation[b][i].x, seconds, settings);
+		filterFace(i, seconds, settings);
+	}
+}
+
+// slots without a body keep their last values, marked invalid, so that every buffer agrees
+void KinectBase::keepInactiveFaces()
+{
+	const int b = buffers.getBack();
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		if(!isFaceTracked[b][i])keepFace(i);
+	}
+}
 
-		if (SUCCEEDED(hr))
+// rebuilds the set of slots with a tracked body, face work is limited to these
+void KinectBase::updateActiveSlots(bool hasBodies, INT64 time)
+{
+	const int b = buffers.getBack();
+	if (hasBodies)
+	{
+		persons.update(trackingIds, time);
+		activeCount = 0;
+		for (int i = 0; i < BODY_COUNT; i++)
 		{
-			if (width == COLOR_WIDTH && height == COLOR_HEIGHT)
-			{
-				if (imageFormat == ColorImageFormat_Rgba)
-				{
-					pixels = color->getPixels();
-					hr = colorFrame->AccessRawUnderlyingBuffer(&bufferSize, &pixels);
-				}
-				else
-				{
-					pixels = color->getPixels();
-					bufferSize = COLOR_WIDTH * COLOR_HEIGHT * 4;
-					hr = colorFrame->CopyConvertedFrameDataToArray(bufferSize, pixels, ColorImageFormat_Rgba);
-				}
-				if (SUCCEEDED(hr))
-				{
-					color->update();
-					processFaces();
-				}
-			}
+			isFaceTracked[b][i] = trackingIds[i] != 0;
+			if (isFaceTracked[b][i])activeSlots[activeCount++] = i;
 		}
-		SafeRelease(description);
 	}
+	else
+	{
+		memcpy(isFaceTracked[b], isFaceTracked[buffers.getPublished()], sizeof(isFaceTracked[b]));
+	}
+	memcpy(slotTrackingIds[b], trackingIds, sizeof(slotTrackingIds[b]));
+	trackedCount[b] = activeCount;
 
-	SafeRelease(colorFrame);
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		isSlotScheduled[i] = true;
+	}
+	for (int n = 0; n < activeCount; n++)
+	{
+		isSlotScheduled[activeSlots[n]] = quality.isSlotScheduled(n, activeCount);
+	}
 }
 
 void KinectBase::drawColor(int x, int y)
 {
-	color->draw(x, y);
+	drawColor(x, y, getWidth(), getHeight());
 }
 
 void KinectBase::drawColor(int x, int y, int w, int h)
 {
-	color->draw(x, y, w, h);
+	if (!colorTexture.isAllocated())return;
+
+	KinectScopedTimer timer(&stats, KINECT_STAGE_DRAW);
+	if (isColorYuy2)
+	{
+		yuy2Shader.begin();
+		colorTexture.draw(x, y, w, h);
+		yuy2Shader.end();
+	}
+	else
+	{
+		colorTexture.draw(x, y, w, h);
+	}
+}
+
+// rgba copy of the current color frame for consumers that need pixels,
+// false for frames whose pixels the quality scheduler skipped
+bool KinectBase::getColorPixels(ofPixels& pixels)
+{
+	const ofPixels& front = colorPixels[buffers.getFront()];
+	if (!front.isAllocated() || isColorSkipped[buffers.getFront()])return false;
+
+	if (pixels.getWidth() != COLOR_WIDTH || pixels.getHeight() != COLOR_HEIGHT || pixels.getNumChannels() != 4)
+	{
+		pixels.allocate(COLOR_WIDTH, COLOR_HEIGHT, 4);
+	}
+
+	if (isColorYuy2)
+	{
+		KinectScopedTimer timer(&stats, KINECT_STAGE_CONVERT_PIXELS);
+		KinectConvertYuy2ToRgba(front.getPixels(), pixels.getPixels(), COLOR_WIDTH * COLOR_HEIGHT);
+	}
+	else
+	{
+		memcpy(pixels.getPixels(), front.getPixels(), front.size());
+	}
+	return true;
 }
 
 void KinectBase::close()
 {
-	if (!sensor) {
+	if (isThreadRunning())
+	{
+		waitForThread(true);
+	}
+
+	if (!source) {
 		return;
 	}
 
-	sensor->Close();
-	sensor = nullptr;
+	source->close();
+}
+
+static int streamIndex(KinectFrameType stream)
+{
+	switch (stream)
+	{
+	case KINECT_FRAME_COLOR:
+		return 0;
+	case KINECT_FRAME_BODY:
+		return 1;
+	default:
+		return 2;
+	}
+}
+
+// true when the last update() brought in new data for the stream
+bool KinectBase::isFrameNew(KinectFrameType stream)
+{
+	return isStreamNew[streamIndex(stream)];
+}
+
+// number of frames of the stream processed so far
+UINT64 KinectBase::getFrameSequence(KinectFrameType stream)
+{
+	return frameSequence[buffers.getFront()][streamIndex(stream)];
+}
+
+// relative sensor time of the frame in 100ns units
+INT64 KinectBase::getFrameTime()
+{
+	return frameTime[buffers.getFront()];
 }
 
 ofQuaternion KinectBase::getRotation(int idx)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? ofQuaternion(faceRotation[idx].x, faceRotation[idx].y, faceRotation[idx].z, faceRotation[idx].w) : ofQuaternion();
+	if(idx<0 || idx>=BODY_COUNT)return ofQuaternion();
+
+	const Vector4& q = faceRotation[buffers.getFront()][idx];
+	return ofQuaternion(q.x, q.y, q.z, q.w);
 }
 
 bool KinectBase::getIsFaceValid(int idx)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? isFaceValid[idx] : false;
+	return (idx>=0 && idx<BODY_COUNT) ? isFaceValid[buffers.getFront()][idx] : false;
+}
+
+// true while a body is tracked in the slot, even between face frames
+bool KinectBase::getIsFaceTracked(int idx)
+{
+	return (idx>=0 && idx<BODY_COUNT) ? isFaceTracked[buffers.getFront()][idx] : false;
+}
+
+// body tracking id of the slot, 0 when untracked
+UINT64 KinectBase::getTrackingId(int idx)
+{
+	return (idx>=0 && idx<BODY_COUNT) ? slotTrackingIds[buffers.getFront()][idx] : 0;
+}
+
+UINT32 KinectBase::getPersonId(int idx)
+{
+	return (idx>=0 && idx<BODY_COUNT) ? personIds[buffers.getFront()][idx] : 0;
+}
+
+KinectPersonRegistry& KinectBase::getPersons()
+{
+	return persons;
+}
+
+int KinectBase::getTrackedCount()
+{
+	return trackedCount[buffers.getFront()];
 }
 
 int KinectBase::getBodyCount()
@@ -198,68 +497,178 @@ int KinectBase::getBodyCount()
 
 int KinectBase::getWidth()
 {
-	return color->getWidth();
+	return COLOR_WIDTH;
 }
 
 int KinectBase::getHeight()
 {
-	return color->getHeight();
+	return COLOR_HEIGHT;
 }
 
-bool KinectBase::updateBodyData(IBody** bodies)
+void KinectBase::setFilter(const KinectFilterSettings& settings)
 {
-	HRESULT hr = E_FAIL;
-
-	if (bodyFrameReader != nullptr)
+	ofScopedLock lock(filterMutex);
+	for (int i = 0; i < BODY_COUNT; i++)
 	{
-		IBodyFrame* pBodyFrame = nullptr;
-		hr = bodyFrameReader->AcquireLatestFrame(&pBodyFrame);
-		if (SUCCEEDED(hr))
-		{
-			hr = pBodyFrame->GetAndRefreshBodyData(BODY_COUNT, bodies);
-		}
-		SafeRelease(pBodyFrame);
+		filterSettings[i] = settings;
 	}
+}
+
+void KinectBase::setFilter(int idx, const KinectFilterSettings& settings)
+{
+	if(idx<0 || idx>=BODY_COUNT)return;
+
+	ofScopedLock lock(filterMutex);
+	filterSettings[idx] = settings;
+}
+
+KinectFilterSettings KinectBase::getFilter(int idx)
+{
+	if(idx<0 || idx>=BODY_COUNT)return KinectFilterSettings();
 
-	return SUCCEEDED(hr);
+	ofScopedLock lock(filterMutex);
+	return filterSettings[idx];
+}
+
+KinectStats& KinectBase::getStats()
+{
+	return stats;
+}
+
+UINT64 KinectBase::getRejectionCount(KinectFaceRejection reason)
+{
+	return (reason >= 0 && reason < KINECT_FACE_REJECTION_COUNT) ? rejectionCounts[reason].load() : 0;
+}
+
+void KinectBase::setQuality(const KinectQualitySettings& settings)
+{
+	quality.setSettings(settings);
+}
+
+KinectQualitySettings KinectBase::getQuality()
+{
+	return quality.getSettings();
+}
+
+KinectQualityLevel KinectBase::getQualityLevel()
+{
+	return quality.getLevel();
+}
+
+double KinectBase::getFrameCost()
+{
+	return quality.getAverageCost();
+}
+
+// counts the reason of a rejected face, true when the face was accepted
+bool KinectBase::acceptFace(KinectFaceRejection rejection)
+{
+	if (rejection == KINECT_FACE_ACCEPTED)return true;
+
+	rejectionCounts[rejection]++;
+	return false;
+}
+
+// carries a slot that was not updated this frame over from the last published frame
+void KinectBase::keepFace(int idx)
+{
+	faceRotation[buffers.getBack()][idx] = faceRotation[buffers.getPublished()][idx];
+	isFaceValid[buffers.getBack()][idx] = false;
+}
+
+// a slot the quality scheduler left out keeps its last result, validity included
+void KinectBase::skipFace(int idx)
+{
+	keepFace(idx);
+	isFaceValid[buffers.getBack()][idx] = isFaceValid[buffers.getPublished()][idx];
+	stats.count(KINECT_COUNT_FACES_SKIPPED);
 }
 
 ColorSpacePoint KinectBase::cameraToScreen(CameraSpacePoint pp)
 {
-	ColorSpacePoint np;
-	HRESULT hr = coordinateMapper->MapCameraPointToColorSpace( pp, &np );
+	ColorSpacePoint np = {0};
+	cameraToScreen(&pp, &np, 1);
 	return np;
 }
 
-#pragma mark - ofxKinectFace
-
-ofxKinectFace::ofxKinectFace()
+// maps a whole array of camera points in a single call
+bool KinectBase::cameraToScreen(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count)
 {
+	if (!source || count == 0)
+	{
+		return false;
+	}
+
+	KinectScopedTimer timer(&stats, KINECT_STAGE_PROJECTION);
+	return source->mapCameraToColor(src, dst, count);
 }
 
-void ofxKinectFace::setup(){
-	HRESULT hr = E_FAIL;
+#pragma mark - ofxKinectFace
 
-	if (KinectBase::setup())
+ofxKinectFace::ofxKinectFace()
+	: faceFeatures(KINECT_FACE_FEATURES_ALL)
+	, hasPoints(true)
+	, hasProperties(true)
+{
+	// sources only write the requested outputs
+	memset(faceData, 0, sizeof(faceData));
+	for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
 	{
-		hr = NOERROR;
 		for (int i = 0; i < BODY_COUNT; i++)
 		{
-			if (SUCCEEDED(hr))
+			for (int j = 0; j < FacePointType::FacePointType_Count; j++)
 			{
-				hr = CreateFaceFrameSource(sensor, 0, FACE_FRAME_FEATURES, &faceFrameSources[i]);
+				facePoints[b][i][j].X = facePoints[b][i][j].Y = 0.f;
 			}
-			if (SUCCEEDED(hr))
+			for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
 			{
-				hr = faceFrameSources[i]->OpenReader(&faceFrameReaders[i]);
-			}				
+				faceProperties[b][i][j] = DetectionResult_Unknown;
+			}
 		}
 	}
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		faceFilters[i].setup(4 + FacePointType::FacePointType_Count * 2);
+	}
+}
+
+ofxKinectFace::~ofxKinectFace()
+{
+	// the worker reads members of this class, stop it before they go away
+	close();
+}
 
-	if (!sensor || FAILED(hr))
+void ofxKinectFace::setFaceFeatures(DWORD features)
+{
+	faceFeatures = features;
+}
+
+DWORD ofxKinectFace::getFaceFeatures()
+{
+	return faceFeatures;
+}
+
+bool ofxKinectFace::setup(bool threaded){
+	return setup(new KinectLiveSource(), threaded);
+}
+
+bool ofxKinectFace::setup(KinectFrameSource* source, bool threaded){
+	hasPoints = (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_PointsInColorSpace) != 0;
+	hasProperties = (faceFeatures & KINECT_FACE_FEATURE_PROPERTIES) != 0;
+	if (source)
+	{
+		source->setFaceFeatures(faceFeatures);
+	}
+	if (!KinectBase::setup(source, KINECT_SOURCE_FACE, threaded))
 	{
 		ofLogError("No ready Kinect found!");
+		return false;
+	}
+	if (isThreaded)
+	{
+		startThread();
 	}
+	return true;
 }
 
 void ofxKinectFace::update(){
@@ -267,23 +676,26 @@ void ofxKinectFace::update(){
 }
 
 void ofxKinectFace::draw(){
+	KinectScopedTimer timer(&stats, KINECT_STAGE_DRAW);
+	const int f = buffers.getFront();
+
 	for (int i = 0; i < BODY_COUNT; ++i)
 	{
-		if(!isFaceValid[i])continue;
+		if(!isFaceValid[f][i])continue;
 
 		ofSetColor(*FACE_COLOR[i]);
 		ofNoFill();
 		ofSetLineWidth(3);
-		ofRect(faceRect[i]);
+		ofRect(faceRect[f][i]);
 		ofFill();
-		for (int j = 0; j < FacePointType::FacePointType_Count; j++)
+		for (int j = 0; hasPoints && j < FacePointType::FacePointType_Count; j++)
 		{
-			ofCircle(facePoints[i][j].X, facePoints[i][j].Y, 5);
+			ofCircle(facePoints[f][i][j].X, facePoints[f][i][j].Y, 5);
 		}
 
 		std::string text;
 
-		for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+		for (int j = 0; hasProperties && j < FaceProperty::FaceProperty_Count; j++)
 		{
 			switch (j)
 			{
@@ -315,7 +727,7 @@ void ofxKinectFace::draw(){
 				break;
 			}
 
-			switch (faceProperties[i][j]) 
+			switch (faceProperties[f][i][j]) 
 			{
 			case DetectionResult::DetectionResult_Unknown:
 				text += " UnKnown";
@@ -334,10 +746,10 @@ void ofxKinectFace::draw(){
 			text += "\n";
 		}
 
-		float x = faceRotation[i].x;
-		float y = faceRotation[i].y;
-		float z = faceRotation[i].z;
-		float w = faceRotation[i].w;
+		float x = faceRotation[f][i].x;
+		float y = faceRotation[f][i].y;
+		float z = faceRotation[f][i].z;
+		float w = faceRotation[f][i].w;
 		float pitch = atan2(2 * (y * z + w * x), w * w - x * x - y * y + z * z) / PI * 180.f;
 		float yaw = asin(2 * (w * y - x * z)) / PI * 180.f;
 		float roll = atan2(2 * (x * y + w * z), w * w + x * x - y * y - z * z) / PI * 180.f;
@@ -346,273 +758,587 @@ void ofxKinectFace::draw(){
 		text += "FacePitch : " + ofToString((int)pitch) + "\n";
 		text += "FaceRoll : " + ofToString((int)roll) + "\n";
 
-		ofDrawBitmapString(text, faceRect[i].x, faceRect[i].y+faceRect[i].height+20);
+		ofDrawBitmapString(text, faceRect[f][i].x, faceRect[f][i].y+faceRect[f][i].height+20);
 	}
 };
 
 ofRectangle ofxKinectFace::getFaceRect(int idx)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? faceRect[idx] : ofRectangle();
+	return (idx>=0 && idx<BODY_COUNT) ? faceRect[buffers.getFront()][idx] : ofRectangle();
 }
 
 ofPoint ofxKinectFace::getFacePoint(int idx, FacePointType type)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? ofPoint(facePoints[idx][type].X, facePoints[idx][type].Y) : ofPoint();
+	if(idx<0 || idx>=BODY_COUNT)return ofPoint();
+
+	const PointF& p = facePoints[buffers.getFront()][idx][type];
+	return ofPoint(p.X, p.Y);
 }
 
 DetectionResult ofxKinectFace::getFaceProperty(int idx, FaceProperty type)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? faceProperties[idx][type] : DetectionResult_Unknown;
+	return (idx>=0 && idx<BODY_COUNT) ? faceProperties[buffers.getFront()][idx][type] : DetectionResult_Unknown;
 }
 
-void ofxKinectFace::processFaces()
+// copies the latest processed frame, safe to call from any thread
+bool ofxKinectFace::getSnapshot(KinectFaceSnapshot& snapshot)
 {
-	HRESULT hr;
-	IBody* bodies[BODY_COUNT] = {0};
-	bool haveBodyData = updateBodyData(bodies);
+	ofScopedLock lock(snapshotMutex);
+	if (!hasSnapshot)return false;
 
-	for (int i = 0; i < BODY_COUNT; ++i)
+	snapshot = this->snapshot;
+	return true;
+}
+
+void ofxKinectFace::updateSnapshot(INT64 time)
+{
+	const int b = buffers.getBack();
+
+	ofScopedLock lock(snapshotMutex);
+	snapshot.sequence = acquiredSequence[STREAM_FACE];
+	snapshot.time = time;
+	memcpy(snapshot.isValid, isFaceValid[b], sizeof(snapshot.isValid));
+	memcpy(snapshot.isTracked, isFaceTracked[b], sizeof(snapshot.isTracked));
+	memcpy(snapshot.trackingId, trackingIds, sizeof(snapshot.trackingId));
+	memcpy(snapshot.personId, personIds[b], sizeof(snapshot.personId));
+	memcpy(snapshot.rotation, faceRotation[b], sizeof(snapshot.rotation));
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		snapshot.rect[i] = faceRect[b][i];
+	}
+	if (hasPoints)
 	{
-		isFaceValid[i] = false;
+		memcpy(snapshot.points, facePoints[b], sizeof(snapshot.points));
+	}
+	if (hasProperties)
+	{
+		memcpy(snapshot.properties, faceProperties[b], sizeof(snapshot.properties));
+	}
+	hasSnapshot = true;
+}
 
-		IFaceFrame* faceFrame = nullptr;
-		hr = faceFrameReaders[i]->AcquireLatestFrame(&faceFrame);
+void ofxKinectFace::keepFace(int idx)
+{
+	KinectBase::keepFace(idx);
 
-		BOOLEAN trackingIdValid = FALSE;
-		if (SUCCEEDED(hr) && nullptr != faceFrame)
-		{
-			hr = faceFrame->get_IsTrackingIdValid(&trackingIdValid);
-		}
+	const int b = buffers.getBack();
+	const int p = buffers.getPublished();
+	faceRect[b][idx] = faceRect[p][idx];
+	if (hasPoints)
+	{
+		memcpy(facePoints[b][idx], facePoints[p][idx], sizeof(facePoints[b][idx]));
+	}
+	if (hasProperties)
+	{
+		memcpy(faceProperties[b][idx], faceProperties[p][idx], sizeof(faceProperties[b][idx]));
+	}
+}
 
-		if (SUCCEEDED(hr))
-		{
-			if (trackingIdValid)
-			{
-				IFaceFrameResult* faceFrameResult = nullptr;
-				RectI faceBox = {0};
+// the rect and the points are filtered together in color space pixels
+void ofxKinectFace::filterFace(int idx, double time, const KinectFilterSettings& settings)
+{
+	const int b = buffers.getBack();
+	float values[4 + FacePointType::FacePointType_Count * 2] = {0};
+	ofRectangle& rect = faceRect[b][idx];
+	values[0] = rect.x;
+	values[1] = rect.y;
+	values[2] = rect.width;
+	values[3] = rect.height;
+	if (hasPoints)
+	{
+		memcpy(values + 4, facePoints[b][idx], sizeof(facePoints[b][idx]));
+	}
 
-				hr = faceFrame->get_FaceFrameResult(&faceFrameResult);
+	faceFilters[idx].update(values, time, settings);
+	rect.set(values[0], values[1], values[2], values[3]);
+	if (hasPoints)
+	{
+		memcpy(facePoints[b][idx], values + 4, sizeof(facePoints[b][idx]));
+	}
+}
 
-				if (SUCCEEDED(hr) && faceFrameResult != nullptr)
-				{
-					hr = faceFrameResult->get_FaceBoundingBoxInColorSpace(&faceBox);
-
-					if (SUCCEEDED(hr))
-					{			
-						hr = faceFrameResult->GetFacePointsInColorSpace(FacePointType::FacePointType_Count, facePoints[i]);
-					}
-
-					if (SUCCEEDED(hr))
-					{
-						hr = faceFrameResult->get_FaceRotationQuaternion(&faceRotation[i]);
-					}
-
-					if (SUCCEEDED(hr))
-					{			
-						faceRect[i].set(faceBox.Left, faceBox.Top, faceBox.Right-faceBox.Left, faceBox.Bottom-faceBox.Top);
-
-						bool isValid = true;
-						if(faceRect[i].x <= 0 || faceRect[i].x > ofGetWidth())isValid = false;
-						if(faceRect[i].y <= 0 || faceRect[i].y > ofGetHeight())isValid = false;
-						for (int j = 0; j < FacePointType::FacePointType_Count; j++)
-						{
-							if(facePoints[i][j].X <= 0 || facePoints[i][j].X > ofGetWidth())isValid = false;
-							if(facePoints[i][j].Y <= 0 || facePoints[i][j].Y > ofGetHeight())isValid = false;
-						}
-						if(faceRotation[i].x == 0.f && faceRotation[i].y == 0.f && faceRotation[i].z == 0.f && faceRotation[i].w == 0.f)isValid = false;
-						if(isValid)isFaceValid[i] = true;
-					}
-
-					if (SUCCEEDED(hr))
-					{
-						hr = faceFrameResult->GetFaceProperties(FaceProperty::FaceProperty_Count, faceProperties[i]);
-					}
-				}
+void ofxKinectFace::resetFilter(int idx)
+{
+	faceFilters[idx].reset();
+}
 
-				SafeRelease(faceFrameResult);	
-			}
-			else
-			{
-				if (haveBodyData)
-				{
-					IBody* pBody = bodies[i];
-					if (pBody != nullptr)
-					{
-						BOOLEAN tracked = false;
-						hr = pBody->get_IsTracked(&tracked);
-
-						UINT64 trackID;
-						if (SUCCEEDED(hr) && tracked)
-						{
-							hr = pBody->get_TrackingId(&trackID);
-							if (SUCCEEDED(hr))
-							{
-								faceFrameSources[i]->put_TrackingId(trackID);
-							}
-						}
-					}
-				}
-			}
-		}
+bool ofxKinectFace::processFaces()
+{
+	const int b = buffers.getBack();
+	bool hasFaces = false;
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		faceData[i].isActive = isFaceTracked[b][i] && isSlotScheduled[i];
+		isFaceValid[b][i] = false;
+	}
+	{
+		KinectScopedTimer timer(&stats, KINECT_STAGE_FACE_ACQUIRE);
+		source->acquireFaces(faceData);
 	}
 
-	if (haveBodyData)
+	for (int n = 0; n < activeCount; n++)
 	{
-		for (int i = 0; i < _countof(bodies); ++i)
+		const int i = activeSlots[n];
+		if (!isSlotScheduled[i])
 		{
-			SafeRelease(bodies[i]);
+			skipFace(i);
+			continue;
 		}
+
+		const KinectFaceData& face = faceData[i];
+		if (!face.isUpdated)
+		{
+			keepFace(i);
+			continue;
+		}
+
+		// outputs that were not requested keep their initial values
+		faceRect[b][i].set(face.boundingBox.Left, face.boundingBox.Top, face.boundingBox.Right-face.boundingBox.Left, face.boundingBox.Bottom-face.boundingBox.Top);
+		if (hasPoints)
+		{
+			memcpy(facePoints[b][i], face.points, sizeof(facePoints[b][i]));
+		}
+		if (hasProperties)
+		{
+			memcpy(faceProperties[b][i], face.properties, sizeof(faceProperties[b][i]));
+		}
+		faceRotation[b][i] = face.rotation;
+		isFaceValid[b][i] = acceptFace(KinectValidateFace(face, COLOR_WIDTH, COLOR_HEIGHT, faceFeatures));
+		hasFaces = true;
 	}
+
+	return hasFaces;
 }
 
 #pragma mark - ofxKinectHDFace
 
 ofxKinectHDFace::ofxKinectHDFace()
+	: isDrawOnGpu(true)
+	, isMeshDirty(true)
+	, nextVertexVersion(0)
+	, faceVertexCount(0)
+	, meshFaceCount(0)
+	, isPackedOnGpu(false)
+	, meshVertexCount(0)
+	, meshIndexCount(0)
+	, indexLodCount(0)
+	, meshDrawCount(0)
 {
-	for (int i = 0; i < BODY_COUNT; i++)
+	// processFaces() reads the previous frame's pose before the first frame arrived
+	memset(faceData, 0, sizeof(faceData));
+	for (int l = 0; l < KINECT_MESH_LOD_COUNT - 1; l++)
 	{
-		for (int j = 0; j < FaceShapeAnimations_Count; j++)
-		{
-			animationUnits[i][j] = 0.f;
-		}
+		lodDistances[l] = 0.f;
 	}
-}
-
-void ofxKinectHDFace::setup(){
-	HRESULT hr = E_FAIL;
-
-	if (KinectBase::setup())
+	for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
 	{
-		hr = NOERROR;
 		for (int i = 0; i < BODY_COUNT; i++)
 		{
-			if (SUCCEEDED(hr))
-			{
-				hr = CreateHighDefinitionFaceFrameSource(sensor, &faceFrameSources[i]);
-			}
-			if (SUCCEEDED(hr))
-			{
-				hr = faceFrameSources[i]->OpenReader(&faceFrameReaders[i]);
-			}
-			if (SUCCEEDED(hr))
+			headPivot[b][i].X = headPivot[b][i].Y = headPivot[b][i].Z = 0.f;
+			vertexVersions[b][i] = 0;
+			for (int j = 0; j < FaceShapeAnimations_Count; j++)
 			{
-				hr = faceFrameSources[i]->OpenModelBuilder( FaceModelBuilderAttributes::FaceModelBuilderAttributes_None, &faceModelBuilders[i] );
-			}
-			if (SUCCEEDED(hr))
-			{
-				hr = faceModelBuilders[i]->BeginFaceDataCollection();
-			}
-			if (SUCCEEDED(hr))
-			{
-				hr = CreateFaceAlignment( &faceAlignment[i] );
-			}
-			if (SUCCEEDED(hr))
-			{
-				std::vector<float> deformations( FaceShapeDeformations::FaceShapeDeformations_Count, 0.f );
-				hr = CreateFaceModel( 1.0f, FaceShapeDeformations::FaceShapeDeformations_Count, &deformations[0], &faceModel[i] );
+				animationUnits[b][i][j] = 0.f;
 			}
 		}
 	}
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		pivotFilters[i].setup(3, 1000.f);
+		animationFilters[i].setup(FaceShapeAnimations_Count, 100.f);
+		modelTrackingIds[i] = 0;
+		isVertexFresh[i] = false;
+		isModelLoaded[i] = isModelSaved[i] = false;
+		packedSlots[i] = -1;
+		packedVersions[i] = 0;
+		packedLods[i] = 0;
+		packedOffsets[i] = 0;
+		indexLods[i] = 0;
+		for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
+		{
+			modelStatus[b][i] = KINECT_MODEL_GENERIC;
+		}
+	}
+}
+
+ofxKinectHDFace::~ofxKinectHDFace()
+{
+	// the worker reads members of this class, stop it before they go away
+	close();
+}
 
-	if (!sensor || FAILED(hr))
+bool ofxKinectHDFace::setup(bool threaded){
+	return setup(new KinectLiveSource(), threaded);
+}
+
+bool ofxKinectHDFace::setup(KinectFrameSource* source, bool threaded){
+	bool isReady = KinectBase::setup(source, KINECT_SOURCE_HD_FACE, threaded);
+	if (!isReady)
 	{
 		ofLogError("No ready Kinect found!");
 	}
 
 	UINT32 vertexCount = 0;
-	hr = GetFaceModelVertexCount( &vertexCount );
-	if (SUCCEEDED(hr))
+	vector<UINT32> triangles;
+	if (source && source->getFaceTopology(vertexCount, triangles))
 	{
+		CameraSpacePoint origin = {0};
+		for (int b = 0; b < KinectTripleBuffer::COUNT; b++)
+		{
+			for (int i = 0; i < BODY_COUNT; i++)
+			{
+				faceVertices[b][i].assign(vertexCount, origin);
+			}
+		}
 		for (int i = 0; i < BODY_COUNT; i++)
 		{
-			faceVertices[i].assign(vertexCount, CameraSpacePoint());
+			vertexFilters[i].setup(vertexCount * 3, 1000.f);
 		}
 
-		UINT32 triangleCount = 0;
-		hr = GetFaceModelTriangleCount(&triangleCount);
-		if (SUCCEEDED(hr))
+		unsigned long long start = ofGetElapsedTimeMicros();
+		faceVertexCount = vertexCount;
+		faceIndices = std::make_shared<const std::vector<ofIndexType> >(triangles.begin(), triangles.end());
+		KinectBuildMeshLods(vertexCount, triangles, meshLods);
+		if (!isHeadless)
 		{
-			vector<UINT32> triangles;
-			triangles.assign(triangleCount*3, 0);
-			hr = GetFaceModelTriangles(triangles.size(), &triangles[0]);
-			if (SUCCEEDED(hr))
-			{
-				for (int i = 0; i < BODY_COUNT; i++)
-				{
-					for (int j = 0; j < triangles.size(); j++)
-					{
-						faceIndices[i].push_back(triangles[j]);
-					}
-					vbo[i].addVertices(getVertices3D(i));
-					vbo[i].addIndices(faceIndices[i]);
-				}
-			}
+			setupMesh(vertexCount, triangles);
+		}
+		ofLogVerbose("ofxKinectHDFace") << "topology " << triangles.size() << " indices, "
+			<< faceIndices->size() * sizeof(ofIndexType) << " bytes shared by all slots, " << KINECT_MESH_LOD_COUNT << " lod levels, set up in "
+			<< ofGetElapsedTimeMicros() - start << " us";
+	}
+
+	if (source)
+	{
+		colorProjection = source->getColorProjection();
+	}
+
+	// the worker only starts once the vertex buffers are sized
+	if (isReady && isThreaded)
+	{
+		startThread();
+	}
+	return isReady;
+}
+
+// one vertex buffer with room for every slot, and the topology repeated per slot
+// so that any number of packed faces draws with a single call. the index buffer
+// starts at full detail and is only rewritten when a face changes its lod level
+void ofxKinectHDFace::setupMesh(UINT32 vertexCount, const std::vector<UINT32>& triangles)
+{
+	if (ofIsGLProgrammableRenderer() || !meshShader.setupShaderFromSource(GL_VERTEX_SHADER, MESH_VERTEX_SHADER)
+		|| !meshShader.setupShaderFromSource(GL_FRAGMENT_SHADER, MESH_FRAGMENT_SHADER) || !meshShader.linkProgram())
+	{
+		isDrawOnGpu = false;
+	}
+
+	meshVertexCount = vertexCount;
+	meshIndexCount = triangles.size();
+	meshVertices.resize(meshVertexCount * BODY_COUNT);
+	faceMesh.setVertexData(&meshVertices[0].X, 3, meshVertices.size(), GL_STREAM_DRAW, sizeof(CameraSpacePoint));
+
+	meshIndices.resize(meshIndexCount * BODY_COUNT);
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		for (UINT32 j = 0; j < meshIndexCount; j++)
+		{
+			meshIndices[i * meshIndexCount + j] = i * meshVertexCount + triangles[j];
 		}
+		indexLods[i] = 0;
+	}
+	indexLodCount = BODY_COUNT;
+	faceMesh.setIndexData(&meshIndices[0], meshIndices.size(), GL_DYNAMIC_DRAW);
+}
 
+// the gpu path projects with a fitted pinhole model instead of the sensor's mapper
+void ofxKinectHDFace::setDrawOnGpu(bool isGpu)
+{
+	isDrawOnGpu = isGpu;
+	isMeshDirty = true;
+}
+
+void ofxKinectHDFace::setMeshLod(float mediumDistance, float farDistance)
+{
+	lodDistances[0] = mediumDistance;
+	lodDistances[1] = farDistance;
+	isMeshDirty = true;
+}
+
+// the projected size falls with the head's depth, so the depth alone picks the level
+int ofxKinectHDFace::getMeshLodLevel(int idx)
+{
+	if(idx<0 || idx>=BODY_COUNT)return 0;
+
+	const float depth = headPivot[buffers.getFront()][idx].Z;
+	int level = 0;
+	while (level < KINECT_MESH_LOD_COUNT - 1 && lodDistances[level] > 0.f && depth > lodDistances[level])
+	{
+		level++;
+	}
+	// an empty level means the topology had nothing to decimate
+	while (level > 0 && meshLods[level].indices.empty())
+	{
+		level--;
 	}
+	return level;
+}
+
+const KinectMeshLod& ofxKinectHDFace::getMeshLod(int level)
+{
+	return meshLods[ofClamp(level, 0, KINECT_MESH_LOD_COUNT - 1)];
 }
 
 void ofxKinectHDFace::update(){
 	KinectBase::update();
+
+	if (isFrameNew(KINECT_FRAME_FACE) || isFrameNew(KINECT_FRAME_BODY))
+	{
+		isMeshDirty = true;
+	}
 }
 
 void ofxKinectHDFace::draw(){
+	if (meshVertexCount == 0)return;
+
+	KinectScopedTimer timer(&stats, KINECT_STAGE_DRAW);
+	const bool isGpu = isDrawOnGpu && meshShader.isLoaded();
+	if (isMeshDirty)
+	{
+		packMesh(isGpu);
+	}
+	if (meshFaceCount == 0)return;
+
+	if (isGpu)
+	{
+		meshShader.begin();
+		meshShader.setUniform2f("focal", colorProjection.fx, colorProjection.fy);
+		meshShader.setUniform2f("center", colorProjection.cx, colorProjection.cy);
+		meshShader.setUniform2f("offset", colorProjection.tx, colorProjection.ty);
+	}
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	faceMesh.drawElements(GL_TRIANGLES, meshDrawCount);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	if (isGpu)
+	{
+		meshShader.end();
+	}
+}
+
+// packs the tracked faces of the front buffer and uploads them once per new frame,
+// raw camera points for the shader or points mapped by the sensor otherwise.
+// each face packs only the vertices of its lod level, back to back.
+// faces whose vertices did not change keep their packed copy, and an unchanged mesh is not uploaded
+void ofxKinectHDFace::packMesh(bool isGpu)
+{
+	const int f = buffers.getFront();
+	const int packedCount = isGpu == isPackedOnGpu ? meshFaceCount : 0;
+	bool isChanged = false;
+	UINT32 offset = 0;
+
+	meshFaceCount = 0;
 	for (int i = 0; i < BODY_COUNT; i++)
 	{
-		//if(!isFaceValid[i])continue;
+		if(!isFaceTracked[f][i] || faceVertices[f][i].size() != meshVertexCount)continue;
+
+		const int k = meshFaceCount;
+		const int level = getMeshLodLevel(i);
+		const KinectMeshLod& lod = meshLods[level];
+		const UINT32 count = lod.vertices.size();
+		if (k < packedCount && packedSlots[k] == i && packedVersions[k] == vertexVersions[f][i]
+			&& packedLods[k] == level && packedOffsets[k] == offset)
+		{
+			offset += count;
+			meshFaceCount++;
+			continue;
+		}
 
-		for (int j = 0; j < faceVertices[i].size(); j++)
+		isChanged = true;
+		packedSlots[k] = -1;
+		const CameraSpacePoint* src = faceVertices[f][i].data();
+		if (level > 0)
 		{
-			ColorSpacePoint p = cameraToScreen(faceVertices[i][j]);
-			vbo[i].setVertex(j, ofPoint(p.X, p.Y));
+			lodVertices.resize(count);
+			for (UINT32 j = 0; j < count; j++)
+			{
+				lodVertices[j] = src[lod.vertices[j]];
+			}
+			src = lodVertices.data();
+		}
+
+		CameraSpacePoint* dst = &meshVertices[offset];
+		if (isGpu)
+		{
+			memcpy(dst, src, sizeof(CameraSpacePoint) * count);
 		}
-		vbo[i].drawWireframe();
+		else
+		{
+			screenVertices.resize(count);
+			if (!cameraToScreen(src, screenVertices.data(), count))continue;
+
+			for (UINT32 j = 0; j < count; j++)
+			{
+				dst[j].X = screenVertices[j].X;
+				dst[j].Y = screenVertices[j].Y;
+				dst[j].Z = 0.f;
+			}
+		}
+		packedSlots[k] = i;
+		packedVersions[k] = vertexVersions[f][i];
+		packedLods[k] = level;
+		packedOffsets[k] = offset;
+		offset += count;
+		meshFaceCount++;
 	}
+	isPackedOnGpu = isGpu;
+
+	// fewer faces only shorten the drawn range, other levels rewrite the indices
+	bool isIndexChanged = meshFaceCount > indexLodCount;
+	meshDrawCount = 0;
+	for (int k = 0; k < meshFaceCount; k++)
+	{
+		isIndexChanged = isIndexChanged || indexLods[k] != packedLods[k];
+		meshDrawCount += meshLods[packedLods[k]].indices.size();
+	}
+	if (isIndexChanged)
+	{
+		UINT32 index = 0;
+		for (int k = 0; k < meshFaceCount; k++)
+		{
+			const std::vector<ofIndexType>& indices = meshLods[packedLods[k]].indices;
+			for (size_t j = 0; j < indices.size(); j++)
+			{
+				meshIndices[index++] = packedOffsets[k] + indices[j];
+			}
+			indexLods[k] = packedLods[k];
+		}
+		indexLodCount = meshFaceCount;
+		faceMesh.updateIndexData(&meshIndices[0], meshDrawCount);
+	}
+
+	if (isChanged && meshFaceCount > 0)
+	{
+		KinectScopedTimer timer(&stats, KINECT_STAGE_UPLOAD);
+		faceMesh.updateVertexData(&meshVertices[0].X, offset);
+		stats.count(KINECT_COUNT_MESH_UPLOADS);
+		stats.count(KINECT_COUNT_VERTICES_UPLOADED, offset);
+	}
+	else
+	{
+		stats.count(KINECT_COUNT_MESH_UPLOADS_SKIPPED);
+	}
+	isMeshDirty = false;
 }
 
 std::vector<ofPoint> ofxKinectHDFace::getVertices3D(int idx)
 {
-	if(idx<0 || idx>=BODY_COUNT)return std::vector<ofPoint>();
+	std::vector<ofPoint> vertices3D;
+	getVertices3D(idx, vertices3D);
+	return vertices3D;
+}
 
-	std::vector<ofPoint> vertices3D(faceVertices[idx].size());
-	for (int i = 0; i < faceVertices[idx].size(); i++)
+// fills the caller's buffer, only allocates while it grows
+bool ofxKinectHDFace::getVertices3D(int idx, std::vector<ofPoint>& vertices3D)
+{
+	if(idx<0 || idx>=BODY_COUNT)
 	{
-		vertices3D[i].x = faceVertices[idx][i].X;
-		vertices3D[i].y = faceVertices[idx][i].Y;
-		vertices3D[i].z = faceVertices[idx][i].Z;
+		vertices3D.clear();
+		return false;
 	}
-	return vertices3D;
+
+	const std::vector<CameraSpacePoint>& vertices = faceVertices[buffers.getFront()][idx];
+	vertices3D.resize(vertices.size());
+	for (int i = 0; i < vertices.size(); i++)
+	{
+		vertices3D[i].set(vertices[i].X, vertices[i].Y, vertices[i].Z);
+	}
+	return true;
 }
 
-std::vector<ofPoint> ofxKinectHDFace::getVertices2D(int idx)
+bool ofxKinectHDFace::getVertices3D(int idx, KinectVertexArrays& vertices3D)
 {
-	if(idx<0 || idx>=BODY_COUNT)return std::vector<ofPoint>();
+	if(idx<0 || idx>=BODY_COUNT)
+	{
+		vertices3D.x.clear();
+		vertices3D.y.clear();
+		vertices3D.z.clear();
+		return false;
+	}
 
-	std::vector<ofPoint> vertices2D(faceVertices[idx].size());
-	for (int i = 0; i < faceVertices[idx].size(); i++)
+	const std::vector<CameraSpacePoint>& vertices = faceVertices[buffers.getFront()][idx];
+	vertices3D.x.resize(vertices.size());
+	vertices3D.y.resize(vertices.size());
+	vertices3D.z.resize(vertices.size());
+	for (int i = 0; i < vertices.size(); i++)
 	{
-		ColorSpacePoint p = cameraToScreen(faceVertices[idx][i]);
-		vertices2D[i].x = p.X;
-		vertices2D[i].y = p.Y;
+		vertices3D.x[i] = vertices[i].X;
+		vertices3D.y[i] = vertices[i].Y;
+		vertices3D.z[i] = vertices[i].Z;
 	}
+	return true;
+}
+
+std::vector<ofPoint> ofxKinectHDFace::getVertices2D(int idx)
+{
+	std::vector<ofPoint> vertices2D;
+	getVertices2D(idx, vertices2D);
 	return vertices2D;
 }
 
-std::vector<ofIndexType> ofxKinectHDFace::getIndices(int idx)
+// fills the caller's buffer, only allocates while it grows
+bool ofxKinectHDFace::getVertices2D(int idx, std::vector<ofPoint>& vertices2D)
+{
+	vertices2D.clear();
+	if(idx<0 || idx>=BODY_COUNT)return false;
+
+	const std::vector<CameraSpacePoint>& vertices = faceVertices[buffers.getFront()][idx];
+	screenVertices.resize(vertices.size());
+	if (!cameraToScreen(vertices.data(), screenVertices.data(), screenVertices.size()))return false;
+
+	vertices2D.resize(screenVertices.size());
+	for (int i = 0; i < screenVertices.size(); i++)
+	{
+		vertices2D[i].set(screenVertices[i].X, screenVertices[i].Y, 0.f);
+	}
+	return true;
+}
+
+// camera space vertices of the front buffer, valid until the next update()
+const std::vector<CameraSpacePoint>& ofxKinectHDFace::getCameraVertices(int idx)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? faceIndices[idx] : std::vector<ofIndexType>();
+	static const std::vector<CameraSpacePoint> empty;
+	return (idx>=0 && idx<BODY_COUNT) ? faceVertices[buffers.getFront()][idx] : empty;
+}
+
+UINT32 ofxKinectHDFace::getVertexCount()
+{
+	return faceVertexCount;
+}
+
+// every slot shares the same topology
+const std::vector<ofIndexType>& ofxKinectHDFace::getIndices(int idx)
+{
+	static const std::vector<ofIndexType> empty;
+	return (idx>=0 && idx<BODY_COUNT && faceIndices) ? *faceIndices : empty;
+}
+
+std::shared_ptr<const std::vector<ofIndexType> > ofxKinectHDFace::getSharedIndices()
+{
+	return faceIndices;
 }
 
 ofPoint ofxKinectHDFace::getHeadPivot3D(int idx)
 {
-	return (idx>=0 && idx<BODY_COUNT) ? ofPoint(headPivot[idx].X, headPivot[idx].Y, headPivot[idx].Z) : ofPoint();
+	if(idx<0 || idx>=BODY_COUNT)return ofPoint();
+
+	const CameraSpacePoint& p = headPivot[buffers.getFront()][idx];
+	return ofPoint(p.X, p.Y, p.Z);
 }
 
 ofPoint ofxKinectHDFace::getHeadPivot2D(int idx)
 {
 	if(idx<0 || idx>=BODY_COUNT)return ofPoint();
 
-	ColorSpacePoint p = cameraToScreen(headPivot[idx]);
+	ColorSpacePoint p = cameraToScreen(headPivot[buffers.getFront()][idx]);
 	return ofPoint(p.X, p.Y);
 }
 
@@ -620,94 +1346,241 @@ float ofxKinectHDFace::getFaceShapeAnimation(int idx, FaceShapeAnimations unit)
 {
 	if(idx<0 || idx>=BODY_COUNT)return 0;
 
-	return animationUnits[idx][unit];
+	return animationUnits[buffers.getFront()][idx][unit];
 }
 
-void ofxKinectHDFace::processFaces()
+// copies the latest processed frame, safe to call from any thread
+bool ofxKinectHDFace::getSnapshot(KinectHDFaceSnapshot& snapshot)
 {
-	HRESULT hr;
-	IBody* bodies[BODY_COUNT] = { 0 };
-	bool haveBodyData = SUCCEEDED(updateBodyData(bodies));
+	ofScopedLock lock(snapshotMutex);
+	if (!hasSnapshot)return false;
 
-	for (int i = 0; i < BODY_COUNT; i++)
-	{
-		isFaceValid[i] = false;
+	snapshot = this->snapshot;
+	return true;
+}
 
-		IHighDefinitionFaceFrame * faceFrame = nullptr;
-		hr = faceFrameReaders[i]->AcquireLatestFrame(&faceFrame);
+void ofxKinectHDFace::updateSnapshot(INT64 time)
+{
+	const int b = buffers.getBack();
+
+	ofScopedLock lock(snapshotMutex);
+	snapshot.sequence = acquiredSequence[STREAM_FACE];
+	snapshot.time = time;
+	memcpy(snapshot.isValid, isFaceValid[b], sizeof(snapshot.isValid));
+	memcpy(snapshot.isTracked, isFaceTracked[b], sizeof(snapshot.isTracked));
+	memcpy(snapshot.trackingId, trackingIds, sizeof(snapshot.trackingId));
+	memcpy(snapshot.personId, personIds[b], sizeof(snapshot.personId));
+	memcpy(snapshot.rotation, faceRotation[b], sizeof(snapshot.rotation));
+	memcpy(snapshot.headPivot, headPivot[b], sizeof(snapshot.headPivot));
+	memcpy(snapshot.animationUnits, animationUnits[b], sizeof(snapshot.animationUnits));
+	hasSnapshot = true;
+}
 
-		BOOLEAN trackingIdValid = FALSE;
-		if (SUCCEEDED(hr) && nullptr != faceFrame)
+void ofxKinectHDFace::keepFace(int idx)
+{
+	KinectBase::keepFace(idx);
+
+	const int b = buffers.getBack();
+	const int p = buffers.getPublished();
+	headPivot[b][idx] = headPivot[p][idx];
+	// equal versions hold equal vertices, a departed face is not copied on every frame
+	if (vertexVersions[b][idx] != vertexVersions[p][idx])
+	{
+		faceVertices[b][idx] = faceVertices[p][idx];
+		vertexVersions[b][idx] = vertexVersions[p][idx];
+	}
+	memcpy(animationUnits[b][idx], animationUnits[p][idx], sizeof(animationUnits[b][idx]));
+}
+
+// camera space values are filtered in meters with speeds scaled to mm/s
+void ofxKinectHDFace::filterFace(int idx, double time, const KinectFilterSettings& settings)
+{
+	const int b = buffers.getBack();
+	pivotFilters[idx].update(&headPivot[b][idx].X, time, settings);
+	animationFilters[idx].update(animationUnits[b][idx], time, settings);
+	if (settings.isVertexFiltered && !faceVertices[b][idx].empty())
+	{
+		// reused vertices were filtered when they were calculated
+		if (isVertexFresh[idx])
 		{
-			hr = faceFrame->get_IsTrackingIdValid(&trackingIdValid);
+			vertexFilters[idx].update(&faceVertices[b][idx][0].X, time, settings);
+			vertexVersions[b][idx] = ++nextVertexVersion;
 		}
+	}
+	else
+	{
+		vertexFilters[idx].reset();
+	}
+}
 
-		if (SUCCEEDED(hr) && trackingIdValid)
-		{
-			hr = faceFrame->GetAndRefreshFaceAlignmentResult(faceAlignment[i]);
+void ofxKinectHDFace::resetFilter(int idx)
+{
+	pivotFilters[idx].reset();
+	animationFilters[idx].reset();
+	vertexFilters[idx].reset();
+}
 
-			if(SUCCEEDED(hr) && faceAlignment[i] != nullptr)
-			{
-				hr = faceAlignment[i]->GetAnimationUnits(FaceShapeAnimations_Count, animationUnits[i]);
+void ofxKinectHDFace::setFaceModelCache(const std::string& directory)
+{
+	ofScopedLock lock(modelMutex);
+	modelCacheDirectory = directory;
+	if (directory.size())
+	{
+		ofDirectory::createDirectory(directory, true, true);
+	}
+}
 
-				if (SUCCEEDED(hr))
-				{
-					hr = faceModel[i]->CalculateVerticesForAlignment(faceAlignment[i], faceVertices[i].size(), &faceVertices[i][0]);
-				}
+void ofxKinectHDFace::setPersonId(UINT64 trackingId, const std::string& personId)
+{
+	persons.setName(trackingId, personId);
+}
 
-				if (SUCCEEDED(hr))
-				{
-					hr = faceAlignment[i]->get_HeadPivotPoint(&headPivot[i]);
-				}
+KinectFaceModelStatus ofxKinectHDFace::getFaceModelStatus(int idx)
+{
+	return (idx>=0 && idx<BODY_COUNT) ? modelStatus[buffers.getFront()][idx] : KINECT_MODEL_GENERIC;
+}
 
-				if (SUCCEEDED(hr))
-				{
-					hr = faceAlignment[i]->get_FaceOrientation(&faceRotation[i]);
-				}
+// a known person gets their shape back from memory or the model cache once, and a freshly
+// fitted shape identifies the person and is saved once
+void ofxKinectHDFace::updateFaceModel(int idx)
+{
+	if (modelTrackingIds[idx] != trackingIds[idx])
+	{
+		modelTrackingIds[idx] = trackingIds[idx];
+		isModelLoaded[idx] = isModelSaved[idx] = false;
+	}
+	if (isModelLoaded[idx] && isModelSaved[idx])return;
 
-				if (SUCCEEDED(hr))
-				{
-					bool isValid = true;
-					ofPoint headPivot = getHeadPivot2D(i);
-					if(headPivot.x <= 0 || headPivot.x > ofGetWidth())isValid = false;
-					if(headPivot.y <= 0 || headPivot.y > ofGetHeight())isValid = false;
-					if(faceRotation[i].x == 0.f && faceRotation[i].y == 0.f && faceRotation[i].z == 0.f && faceRotation[i].w == 0.f)isValid = false;
-					if(isValid)isFaceValid[i] = true;
-				}
+	KinectPerson person;
+	if (!persons.getPerson(persons.getPersonId(idx), person))return;
 
-			}
+	std::string path;
+	{
+		ofScopedLock lock(modelMutex);
+		if (modelCacheDirectory.size() && person.name.size())
+		{
+			path = ofFilePath::join(modelCacheDirectory, person.name + ".okfm");
 		}
-		else
+	}
+
+	KinectFaceModel model;
+	KinectFaceModelStatus status = source->getFaceModelStatus(idx);
+	if (!isModelLoaded[idx] && status != KINECT_MODEL_FITTED)
+	{
+		// the cache file is read once, a name or a merge may still come later
+		bool isKnown = person.hasShape;
+		if (isKnown)
+		{
+			model = person.shape;
+		}
+		else if (path.size())
+		{
+			isModelLoaded[idx] = true;
+			isKnown = model.load(path);
+		}
+		if (isKnown && source->setFaceModel(idx, model))
 		{
-			if (haveBodyData)
+			// the shape is already stored, neither identify nor save it again
+			isModelLoaded[idx] = isModelSaved[idx] = true;
+			ofLogVerbose("ofxKinectHDFace") << "slot " << idx << " uses the known shape of person " << person.id;
+		}
+	}
+	else if (status == KINECT_MODEL_FITTED && !isModelSaved[idx])
+	{
+		isModelLoaded[idx] = isModelSaved[idx] = true;
+		if (source->getFaceModel(idx, model))
+		{
+			UINT32 id = persons.identify(idx, model);
+			// a returning person brings their name
+			if (path.empty() && id != person.id && persons.getPerson(id, person) && person.name.size())
 			{
-				IBody* pBody = bodies[i];
-				if (pBody != nullptr)
+				ofScopedLock lock(modelMutex);
+				if (modelCacheDirectory.size())
 				{
-					BOOLEAN tracked = false;
-					hr = pBody->get_IsTracked(&tracked);
-
-					UINT64 trackID;
-					if (SUCCEEDED(hr) && tracked)
-					{
-						hr = pBody->get_TrackingId(&trackID);
-						if (SUCCEEDED(hr))
-						{
-							faceFrameSources[i]->put_TrackingId(trackID);
-						}
-					}
+					path = ofFilePath::join(modelCacheDirectory, person.name + ".okfm");
 				}
 			}
+			if (path.size())
+			{
+				model.save(path);
+			}
 		}
+	}
+}
 
-		SafeRelease(faceFrame);
+bool ofxKinectHDFace::processFaces()
+{
+	const int b = buffers.getBack();
+	const bool isThrottled = quality.getLevel() >= KINECT_QUALITY_THROTTLED_VERTICES;
+	bool hasFaces = false;
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		// faceData still holds the previous frame's pose, which decides on the vertices of this one
+		KinectHDFaceData& face = faceData[i];
+		face.isVertexRequested = true;
+		if (isThrottled && face.isUpdated)
+		{
+			const ofVec3f pivot(face.headPivot.X, face.headPivot.Y, face.headPivot.Z);
+			const ofQuaternion rotation(face.orientation.x, face.orientation.y, face.orientation.z, face.orientation.w);
+			face.isVertexRequested = quality.isVertexScheduled(i, pivot.z, quality.isStable(pivot, rotation, vertexPivots[i], vertexRotations[i]));
+		}
+
+		// vertices are calculated straight into the back buffer
+		face.isActive = isFaceTracked[b][i] && isSlotScheduled[i];
+		face.vertices = faceVertices[b][i].empty() ? nullptr : &faceVertices[b][i][0];
+		face.vertexCount = faceVertices[b][i].size();
+		isFaceValid[b][i] = false;
+		isVertexFresh[i] = false;
+	}
+	{
+		KinectScopedTimer timer(&stats, KINECT_STAGE_FACE_ACQUIRE);
+		source->acquireHDFaces(faceData);
 	}
 
-	if (haveBodyData)
+	for (int n = 0; n < activeCount; n++)
 	{
-		for (int i = 0; i < _countof(bodies); ++i)
+		const int i = activeSlots[n];
+		updateFaceModel(i);
+		modelStatus[b][i] = source->getFaceModelStatus(i);
+		if (!isSlotScheduled[i])
+		{
+			skipFace(i);
+			continue;
+		}
+
+		const KinectHDFaceData& face = faceData[i];
+		if (!face.isUpdated)
 		{
-			SafeRelease(bodies[i]);
+			keepFace(i);
+			continue;
 		}
+
+		// an unchanged alignment reuses the published vertices, copied only when the back buffer holds older ones
+		if (face.isVertexUpdated)
+		{
+			vertexVersions[b][i] = ++nextVertexVersion;
+			vertexPivots[i].set(face.headPivot.X, face.headPivot.Y, face.headPivot.Z);
+			vertexRotations[i].set(face.orientation.x, face.orientation.y, face.orientation.z, face.orientation.w);
+			isVertexFresh[i] = true;
+			stats.count(KINECT_COUNT_VERTICES_CALCULATED);
+		}
+		else
+		{
+			const int p = buffers.getPublished();
+			if (vertexVersions[b][i] != vertexVersions[p][i])
+			{
+				faceVertices[b][i] = faceVertices[p][i];
+				vertexVersions[b][i] = vertexVersions[p][i];
+			}
+			stats.count(KINECT_COUNT_VERTICES_REUSED);
+		}
+
+		headPivot[b][i] = face.headPivot;
+		faceRotation[b][i] = face.orientation;
+		memcpy(animationUnits[b][i], face.animationUnits, sizeof(animationUnits[b][i]));
+		isFaceValid[b][i] = acceptFace(KinectValidateHDFace(face, colorProjection, COLOR_WIDTH, COLOR_HEIGHT));
+		hasFaces = true;
 	}
-}
\ No newline at end of file
+
+	return hasFaces;
+}
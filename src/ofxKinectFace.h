@@ -9,53 +9,200 @@
 #pragma once
 
 #include "ofMain.h"
+#include <atomic>
+#include <memory>
 #include <Kinect.h>
 #include <Kinect.Face.h>
+#include "ofxKinectFaceSource.h"
+#include "ofxKinectFaceFilter.h"
+#include "ofxKinectFacePerson.h"
+#include "ofxKinectFaceQuality.h"
+#include "ofxKinectFaceLod.h"
+
+#pragma mark - KinectTripleBuffer
+
+// lock-free triple buffer indices for one producer and one consumer
+class KinectTripleBuffer
+{
+public:
+	enum { COUNT = 3 };
+
+	KinectTripleBuffer() : middle(2), front(0), back(1), published(0) {}
+
+	int getFront() const { return front; }
+	int getBack() const { return back; }
+	int getPublished() const { return published; }
+
+	// producer: hand the finished back buffer over to the consumer
+	void publish()
+	{
+		published = back;
+		back = middle.exchange(back | DIRTY) & INDEX;
+	}
+
+	// consumer: take the newest published buffer, false if nothing new
+	bool swap()
+	{
+		if (!(middle.load() & DIRTY))return false;
+		front = middle.exchange(front) & INDEX;
+		return true;
+	}
+
+private:
+	enum { INDEX = 0x3, DIRTY = 0x4 };
+
+	std::atomic<int> middle;
+	int front;
+	int back;
+	int published;
+};
 
 #pragma mark - KinectBase
 
 // kinect face common class
-class KinectBase
+class KinectBase : protected ofThread
 {
 public:
 	KinectBase();
-	~KinectBase();
+	virtual ~KinectBase();
 
-	bool setup();
+	void setRequiredFrames(int frames);
+	void setHeadless(bool isHeadless);
+	// frames are acquired by the owner calling acquireExternalFrame() on any thread and
+	// update() only swaps buffers, overrides threaded, call before setup()
+	void setExternallyDriven(bool isExternal);
+	bool getExternallyDriven();
+	// acquires and publishes one frame if one is ready, false otherwise
+	bool acquireExternalFrame();
 	void update();
 	virtual void draw(){};
 	void drawColor(int x, int y);
 	void drawColor(int x, int y, int w, int h);
+	bool getColorPixels(ofPixels& pixels);
 	void close();
+	bool isFrameNew(KinectFrameType stream = KINECT_FRAME_FACE);
+	UINT64 getFrameSequence(KinectFrameType stream = KINECT_FRAME_FACE);
+	INT64 getFrameTime();
 	ofQuaternion getRotation(int idx);
 	bool getIsFaceValid(int idx);
+	bool getIsFaceTracked(int idx);
+	UINT64 getTrackingId(int idx);
+	// persistent person of the slot, 0 when untracked
+	UINT32 getPersonId(int idx);
+	KinectPersonRegistry& getPersons();
+	int getTrackedCount();
 	int getBodyCount();
 	int getWidth();
 	int getHeight();
+	// smoothing of every slot, or of one slot
+	void setFilter(const KinectFilterSettings& settings);
+	void setFilter(int idx, const KinectFilterSettings& settings);
+	KinectFilterSettings getFilter(int idx);
+	// per stage timings, call getStats().setEnabled(true) to start recording
+	KinectStats& getStats();
+	// faces rejected by validation since setup(), per KinectFaceRejection
+	UINT64 getRejectionCount(KinectFaceRejection reason);
+	// adaptive work reduction while frames take longer than the budget, off by default
+	void setQuality(const KinectQualitySettings& settings);
+	KinectQualitySettings getQuality();
+	KinectQualityLevel getQualityLevel();
+	// moving average of the worker's time per frame in microseconds
+	double getFrameCost();
 
 protected:
-	virtual void processFaces(){};
-	bool updateBodyData(IBody** bodies);
+	enum { STREAM_COLOR, STREAM_BODY, STREAM_FACE, STREAM_COUNT };
+
+	bool setup(KinectFrameSource* source, KinectSourceMode mode, bool threaded);
+	virtual bool processFaces(){ return false; };
+	virtual void keepFace(int idx);
+	void skipFace(int idx);
+	void keepInactiveFaces();
+	virtual void updateSnapshot(INT64 time){};
+	virtual void filterFace(int idx, double time, const KinectFilterSettings& settings){};
+	virtual void resetFilter(int idx){};
+	void filterFaces(INT64 time);
+	bool acceptFace(KinectFaceRejection rejection);
+	void threadedFunction();
+	bool acquireFrame();
+	void updateActiveSlots(bool hasBodies, INT64 time);
 	ColorSpacePoint cameraToScreen(CameraSpacePoint pp);
+	bool cameraToScreen(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count);
 
-	template<class Interface>
-	inline void SafeRelease(Interface *& pInterfaceToRelease)
-	{
-		if (pInterfaceToRelease != NULL)
-		{
-			pInterfaceToRelease->Release();
-			pInterfaceToRelease = NULL;
-		}
-	}
+	KinectFrameSource* source;
+	int requiredFrames;
+	UINT64 trackingIds[BODY_COUNT]; // worker side, from the latest body frame
+	int activeSlots[BODY_COUNT];    // worker side, slots with a tracked body
+	int activeCount;
+	bool isBodyPending; // worker side, trackingIds changed since the last processed frame
+	INT64 bodyTime;
+	bool isSlotScheduled[BODY_COUNT]; // worker side, false for slots the quality scheduler skips this frame
 
-	IKinectSensor* sensor;
-	IColorFrameReader* colorFrameReader;
-	IBodyFrameReader* bodyFrameReader;
-	ICoordinateMapper* coordinateMapper;
-	Vector4 faceRotation[BODY_COUNT];
-	bool isFaceValid[BODY_COUNT];
+	// results are written to buffers.getBack() and read from buffers.getFront()
+	KinectTripleBuffer buffers;
+	ofPixels colorPixels[KinectTripleBuffer::COUNT]; // yuy2 or rgba, see isColorYuy2
+	bool isColorSkipped[KinectTripleBuffer::COUNT];  // the frame's pixels were not copied
+	Vector4 faceRotation[KinectTripleBuffer::COUNT][BODY_COUNT];
+	bool isFaceValid[KinectTripleBuffer::COUNT][BODY_COUNT];
+	bool isFaceTracked[KinectTripleBuffer::COUNT][BODY_COUNT];
+	UINT64 slotTrackingIds[KinectTripleBuffer::COUNT][BODY_COUNT];
+	UINT32 personIds[KinectTripleBuffer::COUNT][BODY_COUNT];
+	int trackedCount[KinectTripleBuffer::COUNT];
+	UINT64 frameSequence[KinectTripleBuffer::COUNT][STREAM_COUNT];
+	INT64 frameTime[KinectTripleBuffer::COUNT];
+	UINT64 acquiredSequence[STREAM_COUNT]; // worker side
+	UINT64 seenSequence[STREAM_COUNT];     // update() side
+	bool isStreamNew[STREAM_COUNT];
+	bool isThreaded;
+	bool isExternallyDriven;
+	bool isColorYuy2;
+	bool isHeadless;
+	bool hasSnapshot;
+	ofMutex snapshotMutex;
 
-	ofImage* color;
+	// applied on the worker after processFaces(), guarded by filterMutex
+	KinectFilterSettings filterSettings[BODY_COUNT];
+	KinectRotationFilter rotationFilters[BODY_COUNT];
+	UINT64 filteredIds[BODY_COUNT];
+	ofMutex filterMutex;
+
+	KinectStats stats;
+	KinectPersonRegistry persons; // updated with every body frame
+	KinectQualityScheduler quality;
+	std::atomic<UINT64> rejectionCounts[KINECT_FACE_REJECTION_COUNT];
+
+	ofTexture colorTexture;
+	ofShader yuy2Shader;
+};
+
+#pragma mark - Snapshots
+
+// one processed frame of ofxKinectFace results, copied out as a whole
+__declspec(align(64)) struct KinectFaceSnapshot
+{
+	UINT64 sequence; // face frame sequence, see getFrameSequence()
+	INT64 time;      // relative sensor time
+	bool isValid[BODY_COUNT];
+	bool isTracked[BODY_COUNT];
+	UINT64 trackingId[BODY_COUNT]; // body tracking id of the slot, 0 when untracked
+	UINT32 personId[BODY_COUNT];   // persistent person of the slot, 0 when untracked
+	Vector4 rotation[BODY_COUNT];
+	ofRectangle rect[BODY_COUNT];
+	PointF points[BODY_COUNT][FacePointType::FacePointType_Count];
+	DetectionResult properties[BODY_COUNT][FaceProperty::FaceProperty_Count];
+};
+
+// one processed frame of ofxKinectHDFace results, vertices are not included
+__declspec(align(64)) struct KinectHDFaceSnapshot
+{
+	UINT64 sequence;
+	INT64 time;
+	bool isValid[BODY_COUNT];
+	bool isTracked[BODY_COUNT];
+	UINT64 trackingId[BODY_COUNT]; // body tracking id of the slot, 0 when untracked
+	UINT32 personId[BODY_COUNT];   // persistent person of the slot, 0 when untracked
+	Vector4 rotation[BODY_COUNT];
+	CameraSpacePoint headPivot[BODY_COUNT];
+	float animationUnits[BODY_COUNT][FaceShapeAnimations_Count];
 };
 
 #pragma mark - ofxKinectFace
@@ -65,54 +212,148 @@ class ofxKinectFace : public KinectBase
 {
 public:
 	ofxKinectFace();
+	~ofxKinectFace();
 
-	void setup();
+	// FaceFrameFeatures to request, takes effect at setup(). outputs left out are neither
+	// computed by the sdk nor copied, and read back as zero or DetectionResult_Unknown
+	void setFaceFeatures(DWORD features);
+	DWORD getFaceFeatures();
+	// false when the source could not be opened
+	bool setup(bool threaded = false);
+	bool setup(KinectFrameSource* source, bool threaded = false);
 	void update();
 	void draw();
 	ofRectangle getFaceRect(int idx);
 	ofPoint getFacePoint(int idx, FacePointType type);
 	DetectionResult getFaceProperty(int idx, FaceProperty type);
+	bool getSnapshot(KinectFaceSnapshot& snapshot);
 
 private:
-	void processFaces();
-    
-    IFaceFrameSource* faceFrameSources[BODY_COUNT]; // Face sources
-    IFaceFrameReader* faceFrameReaders[BODY_COUNT]; // Face readers
-	ofRectangle faceRect[BODY_COUNT];
-	PointF facePoints[BODY_COUNT][FacePointType::FacePointType_Count];
-	DetectionResult faceProperties[BODY_COUNT][FaceProperty::FaceProperty_Count];
+	bool processFaces();
+	void keepFace(int idx);
+	void updateSnapshot(INT64 time);
+	void filterFace(int idx, double time, const KinectFilterSettings& settings);
+	void resetFilter(int idx);
+
+	KinectFaceSnapshot snapshot; // guarded by snapshotMutex
+	KinectOneEuroFilter faceFilters[BODY_COUNT]; // rect and points
+	DWORD faceFeatures;
+	bool hasPoints;
+	bool hasProperties;
+
+	KinectFaceData faceData[BODY_COUNT];
+	ofRectangle faceRect[KinectTripleBuffer::COUNT][BODY_COUNT];
+	PointF facePoints[KinectTripleBuffer::COUNT][BODY_COUNT][FacePointType::FacePointType_Count];
+	DetectionResult faceProperties[KinectTripleBuffer::COUNT][BODY_COUNT][FaceProperty::FaceProperty_Count];
 };
 
 #pragma mark - ofxKinectHDFace
 
+// struct of arrays copy of one face's vertices
+struct KinectVertexArrays
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+};
+
 // kinect hd face wrapper
 class ofxKinectHDFace : public KinectBase
 {
 public:
 	ofxKinectHDFace();
+	~ofxKinectHDFace();
 
-	void setup();
+	// false when the source could not be opened
+	bool setup(bool threaded = false);
+	bool setup(KinectFrameSource* source, bool threaded = false);
+	void setDrawOnGpu(bool isGpu);
+	// faces beyond these head depths in meters are drawn with the decimated levels, 0 keeps full detail
+	void setMeshLod(float mediumDistance, float farDistance);
+	int getMeshLodLevel(int idx);
+	// built from the topology in setup(), level 0 is the full model
+	const KinectMeshLod& getMeshLod(int level);
 	void update();
 	void draw();
 	std::vector<ofPoint> getVertices3D(int idx);
 	std::vector<ofPoint> getVertices2D(int idx);
-	std::vector<ofIndexType> getIndices(int idx);
+	bool getVertices3D(int idx, std::vector<ofPoint>& vertices);
+	bool getVertices3D(int idx, KinectVertexArrays& vertices);
+	bool getVertices2D(int idx, std::vector<ofPoint>& vertices);
+	const std::vector<CameraSpacePoint>& getCameraVertices(int idx);
+	// of the hd face model, 0 until setup() read the topology
+	UINT32 getVertexCount();
+	const std::vector<ofIndexType>& getIndices(int idx);
+	std::shared_ptr<const std::vector<ofIndexType> > getSharedIndices();
 	ofPoint getHeadPivot3D(int idx);
 	ofPoint getHeadPivot2D(int idx);
 	float getFaceShapeAnimation(int idx, FaceShapeAnimations unit);
+	bool getSnapshot(KinectHDFaceSnapshot& snapshot);
+	// fitted face models are saved to and loaded from this directory, keyed by person id
+	void setFaceModelCache(const std::string& directory);
+	// names the person behind a body, a cached model skips the collection phase
+	// and a returning person of the same name keeps their person id
+	void setPersonId(UINT64 trackingId, const std::string& personId);
+	KinectFaceModelStatus getFaceModelStatus(int idx);
 
 private:
-	void processFaces();
+	bool processFaces();
+	void keepFace(int idx);
+	void updateSnapshot(INT64 time);
+	void filterFace(int idx, double time, const KinectFilterSettings& settings);
+	void resetFilter(int idx);
+	void updateFaceModel(int idx);
+	void setupMesh(UINT32 vertexCount, const std::vector<UINT32>& triangles);
+	void packMesh(bool isGpu);
 
-	IHighDefinitionFaceFrameSource*	faceFrameSources[BODY_COUNT];
-	IHighDefinitionFaceFrameReader*	faceFrameReaders[BODY_COUNT];
-	IFaceModelBuilder* faceModelBuilders[BODY_COUNT];
-	IFaceModel* faceModel[BODY_COUNT];
-	IFaceAlignment* faceAlignment[BODY_COUNT];
-	CameraSpacePoint headPivot[BODY_COUNT];
-	std::vector<CameraSpacePoint> faceVertices[BODY_COUNT];
-	std::vector<ofIndexType> faceIndices[BODY_COUNT];
-	float animationUnits[BODY_COUNT][FaceShapeAnimations_Count];
+	KinectHDFaceData faceData[BODY_COUNT];
+	CameraSpacePoint headPivot[KinectTripleBuffer::COUNT][BODY_COUNT];
+	std::vector<CameraSpacePoint> faceVertices[KinectTripleBuffer::COUNT][BODY_COUNT];
+	UINT64 vertexVersions[KinectTripleBuffer::COUNT][BODY_COUNT]; // changes whenever the vertices do
+	UINT64 nextVertexVersion;
+	// worker side, head pose at the last vertex update for the quality scheduler
+	ofVec3f vertexPivots[BODY_COUNT];
+	ofQuaternion vertexRotations[BODY_COUNT];
+	bool isVertexFresh[BODY_COUNT]; // calculated this frame rather than reused
+	std::shared_ptr<const std::vector<ofIndexType> > faceIndices; // immutable, shared by all slots
+	UINT32 faceVertexCount;
+	float animationUnits[KinectTripleBuffer::COUNT][BODY_COUNT][FaceShapeAnimations_Count];
+	std::vector<ColorSpacePoint> screenVertices; // scratch buffer for batch mapping
+	KinectHDFaceSnapshot snapshot; // guarded by snapshotMutex
+	KinectOneEuroFilter pivotFilters[BODY_COUNT];
+	KinectOneEuroFilter animationFilters[BODY_COUNT];
+	KinectOneEuroFilter vertexFilters[BODY_COUNT];
+
+	// per person model cache, guarded by modelMutex
+	std::string modelCacheDirectory;
+	ofMutex modelMutex;
+	UINT64 modelTrackingIds[BODY_COUNT]; // worker side, body the model state belongs to
+	bool isModelLoaded[BODY_COUNT];
+	bool isModelSaved[BODY_COUNT];
+	KinectFaceModelStatus modelStatus[KinectTripleBuffer::COUNT][BODY_COUNT];
 
-	ofVboMesh vbo[BODY_COUNT];
+	// tracked faces packed into one buffer, projected in the vertex shader
+	// or mapped on the cpu when isDrawOnGpu is off
+	bool isDrawOnGpu;
+	bool isMeshDirty;
+	int meshFaceCount;
+	int packedSlots[BODY_COUNT]; // slot, vertex version, lod level and first vertex of each packed face
+	UINT64 packedVersions[BODY_COUNT];
+	int packedLods[BODY_COUNT];
+	UINT32 packedOffsets[BODY_COUNT];
+	bool isPackedOnGpu;
+	UINT32 meshVertexCount;
+	UINT32 meshIndexCount;
+	// the index buffer follows the lod levels of the packed faces
+	KinectMeshLod meshLods[KINECT_MESH_LOD_COUNT];
+	float lodDistances[KINECT_MESH_LOD_COUNT - 1];
+	int indexLods[BODY_COUNT];
+	int indexLodCount;
+	UINT32 meshDrawCount; // indices of the packed faces
+	std::vector<ofIndexType> meshIndices;
+	std::vector<CameraSpacePoint> lodVertices; // scratch buffer for mapping a level's vertices
+	KinectColorProjection colorProjection; // pinhole fit, for validation and the mesh shader
+	std::vector<CameraSpacePoint> meshVertices;
+	ofVbo faceMesh;
+	ofShader meshShader;
 };
\ No newline at end of file
@@ -0,0 +1,529 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceBatch.h"
+
+static const int COLOR_WIDTH = 1920;
+static const int COLOR_HEIGHT = 1080;
+
+// "OKFC", version, row count and column count, then every column as its name,
+// its type and the values of all rows
+static const char COLUMN_MAGIC[4] = { 'O', 'K', 'F', 'C' };
+static const UINT32 COLUMN_VERSION = 1;
+
+enum ColumnType
+{
+	COLUMN_INT32,
+	COLUMN_INT64,
+	COLUMN_UINT64,
+	COLUMN_FLOAT32,
+	COLUMN_UINT8,
+};
+
+struct ColumnFileHeader
+{
+	char magic[4];
+	UINT32 version;
+	UINT64 rowCount;
+	UINT32 columnCount;
+	UINT32 reserved;
+};
+
+struct ColumnHeader
+{
+	char name[32];
+	UINT32 type;
+	UINT32 valueBytes;
+};
+
+static const char* PROPERTY_NAMES[FaceProperty::FaceProperty_Count] = {
+	"Happy", "Engaged", "WearingGlasses", "LeftEyeClosed", "RightEyeClosed", "MouthOpen", "MouthMoved", "LookingAway"
+};
+
+static const char* ANIMATION_NAMES[FaceShapeAnimations_Count] = {
+	"JawOpen", "LipPucker", "JawSlideRight", "LipStretcherRight", "LipStretcherLeft",
+	"LipCornerPullerLeft", "LipCornerPullerRight", "LipCornerDepressorLeft", "LipCornerDepressorRight",
+	"LeftcheekPuff", "RightcheekPuff", "LefteyeClosed", "RighteyeClosed",
+	"RighteyebrowLowerer", "LefteyebrowLowerer", "LowerlipDepressorLeft", "LowerlipDepressorRight"
+};
+
+template<class T>
+static void appendColumn(std::vector<T>& column, const std::vector<T>& other)
+{
+	column.insert(column.end(), other.begin(), other.end());
+}
+
+// columns of another length than the rows belong to the other face mode and are left out
+template<class T>
+static bool writeColumn(FILE* file, const std::string& name, ColumnType type, const std::vector<T>& column, size_t rowCount)
+{
+	if (column.size() != rowCount)return true;
+
+	ColumnHeader header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+	header.type = type;
+	header.valueBytes = sizeof(T);
+	return fwrite(&header, sizeof(header), 1, file) == 1 && (rowCount == 0 || fwrite(column.data(), sizeof(T), rowCount, file) == rowCount);
+}
+
+template<class T>
+static int countColumn(const std::vector<T>& column, size_t rowCount)
+{
+	return column.size() == rowCount ? 1 : 0;
+}
+
+static int angleBin(float degrees)
+{
+	return ofClamp((int)floorf((degrees + 90.f) / (180.f / KINECT_BATCH_ANGLE_BINS)), 0, KINECT_BATCH_ANGLE_BINS - 1);
+}
+
+KinectBatchSettings::KinectBatchSettings()
+	: threadCount(0)
+	, chunkFrames(900)
+	, warmupFrames(30)
+{
+	// offline there is no latency to cover
+	filter.isEnabled = true;
+	filter.prediction = 0.f;
+}
+
+#pragma mark - KinectBatchColumns
+
+void KinectBatchColumns::clear()
+{
+	*this = KinectBatchColumns();
+}
+
+void KinectBatchColumns::append(const KinectBatchColumns& other)
+{
+	appendColumn(frame, other.frame);
+	appendColumn(time, other.time);
+	appendColumn(slot, other.slot);
+	appendColumn(trackingId, other.trackingId);
+	appendColumn(yaw, other.yaw);
+	appendColumn(pitch, other.pitch);
+	appendColumn(roll, other.roll);
+	appendColumn(colorX, other.colorX);
+	appendColumn(colorY, other.colorY);
+	appendColumn(pivotX, other.pivotX);
+	appendColumn(pivotY, other.pivotY);
+	appendColumn(pivotZ, other.pivotZ);
+	for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+	{
+		appendColumn(properties[j], other.properties[j]);
+	}
+	for (int j = 0; j < FaceShapeAnimations_Count; j++)
+	{
+		appendColumn(animationUnits[j], other.animationUnits[j]);
+	}
+}
+
+#pragma mark - KinectBatchMetrics
+
+KinectBatchMetrics::KinectBatchMetrics()
+{
+	clear();
+}
+
+void KinectBatchMetrics::clear()
+{
+	faceFrames = 0;
+	memset(animationSum, 0, sizeof(animationSum));
+	memset(animationSquares, 0, sizeof(animationSquares));
+	memset(propertyCounts, 0, sizeof(propertyCounts));
+	memset(yawHistogram, 0, sizeof(yawHistogram));
+	memset(pitchHistogram, 0, sizeof(pitchHistogram));
+	memset(rollHistogram, 0, sizeof(rollHistogram));
+}
+
+void KinectBatchMetrics::merge(const KinectBatchMetrics& other)
+{
+	faceFrames += other.faceFrames;
+	for (int j = 0; j < FaceShapeAnimations_Count; j++)
+	{
+		animationSum[j] += other.animationSum[j];
+		animationSquares[j] += other.animationSquares[j];
+	}
+	for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+	{
+		for (int r = 0; r <= DetectionResult::DetectionResult_Maybe; r++)
+		{
+			propertyCounts[j][r] += other.propertyCounts[j][r];
+		}
+	}
+	for (int j = 0; j < KINECT_BATCH_ANGLE_BINS; j++)
+	{
+		yawHistogram[j] += other.yawHistogram[j];
+		pitchHistogram[j] += other.pitchHistogram[j];
+		rollHistogram[j] += other.rollHistogram[j];
+	}
+}
+
+float KinectBatchMetrics::getAnimationMean(FaceShapeAnimations unit) const
+{
+	return faceFrames > 0 ? animationSum[unit] / faceFrames : 0.f;
+}
+
+float KinectBatchMetrics::getAnimationDeviation(FaceShapeAnimations unit) const
+{
+	if (faceFrames == 0)return 0.f;
+
+	double mean = animationSum[unit] / faceFrames;
+	return sqrt(MAX(animationSquares[unit] / faceFrames - mean * mean, 0.0));
+}
+
+float KinectBatchMetrics::getPropertyRate(FaceProperty property) const
+{
+	UINT64 total = 0;
+	for (int r = 0; r <= DetectionResult::DetectionResult_Maybe; r++)
+	{
+		total += propertyCounts[property][r];
+	}
+	return total > 0 ? (float)propertyCounts[property][DetectionResult::DetectionResult_Yes] / total : 0.f;
+}
+
+std::string KinectBatchMetrics::getSummary() const
+{
+	std::string text = "faces : " + ofToString(faceFrames) + "\n";
+	for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+	{
+		if (getPropertyRate((FaceProperty)j) > 0.f)
+		{
+			text += std::string(PROPERTY_NAMES[j]) + " : " + ofToString(100.f * getPropertyRate((FaceProperty)j), 1) + "%\n";
+		}
+	}
+	for (int j = 0; j < FaceShapeAnimations_Count; j++)
+	{
+		if (animationSum[j] != 0.0)
+		{
+			text += std::string(ANIMATION_NAMES[j]) + " : " + ofToString(getAnimationMean((FaceShapeAnimations)j), 3)
+				+ " +- " + ofToString(getAnimationDeviation((FaceShapeAnimations)j), 3) + "\n";
+		}
+	}
+
+	// the most common head pose
+	int yaw = 0, pitch = 0;
+	for (int j = 1; j < KINECT_BATCH_ANGLE_BINS; j++)
+	{
+		if (yawHistogram[j] > yawHistogram[yaw])yaw = j;
+		if (pitchHistogram[j] > pitchHistogram[pitch])pitch = j;
+	}
+	const int binDegrees = 180 / KINECT_BATCH_ANGLE_BINS;
+	text += "most frequent yaw : " + ofToString(yaw * binDegrees - 90) + " to " + ofToString((yaw + 1) * binDegrees - 90) + " degrees\n";
+	text += "most frequent pitch : " + ofToString(pitch * binDegrees - 90) + " to " + ofToString((pitch + 1) * binDegrees - 90) + " degrees\n";
+	return text;
+}
+
+#pragma mark - KinectBatchProcessor
+
+KinectBatchProcessor::KinectBatchProcessor()
+	: mode(KINECT_SOURCE_FACE)
+	, features(KINECT_FACE_FEATURES_ALL)
+	, frameCount(0)
+	, elapsedSeconds(0.0)
+{
+}
+
+void KinectBatchProcessor::setSettings(const KinectBatchSettings& settings)
+{
+	this->settings = settings;
+}
+
+const KinectBatchSettings& KinectBatchProcessor::getSettings() const
+{
+	return settings;
+}
+
+bool KinectBatchProcessor::process(const std::string& path, KinectSourceMode mode)
+{
+	unsigned long long start = ofGetElapsedTimeMicros();
+	this->path = path;
+	this->mode = mode;
+	columns.clear();
+	metrics.clear();
+	frameCount = 0;
+	elapsedSeconds = 0.0;
+
+	{
+		KinectReplaySource source(path, false, false);
+		if (!source.open(mode, KINECT_FRAME_BODY))return false;
+
+		frameCount = source.getFrameCount();
+		projection = source.getColorProjection();
+		features = source.getRecordedFaceFeatures();
+	}
+
+	// chunk boundaries only depend on the settings, never on the thread count
+	const int chunkFrames = MAX(settings.chunkFrames, 1);
+	std::vector<Chunk> chunks((frameCount + chunkFrames - 1) / chunkFrames);
+	for (size_t n = 0; n < chunks.size(); n++)
+	{
+		chunks[n].first = n * chunkFrames;
+		chunks[n].last = MIN((int)(n + 1) * chunkFrames, frameCount);
+		chunks[n].isFailed = false;
+	}
+
+	// the calling thread takes part in wait(), so the pool needs one worker less
+	int threadCount = settings.threadCount > 0 ? settings.threadCount : MAX((int)std::thread::hardware_concurrency(), 1);
+	threadCount = MIN(threadCount, (int)chunks.size());
+	KinectWorkerPool pool;
+	if (threadCount > 1)
+	{
+		pool.setup(threadCount - 1);
+	}
+	for (size_t n = 0; n < chunks.size(); n++)
+	{
+		Chunk* chunk = &chunks[n];
+		pool.push([this, chunk](){ processChunk(*chunk); });
+	}
+	pool.wait();
+	pool.close();
+
+	int failedCount = 0;
+	for (size_t n = 0; n < chunks.size(); n++)
+	{
+		if (chunks[n].isFailed)failedCount++;
+		columns.append(chunks[n].columns);
+		metrics.merge(chunks[n].metrics);
+	}
+
+	elapsedSeconds = (ofGetElapsedTimeMicros() - start) / 1e6;
+	ofLogVerbose("KinectBatchProcessor") << path << " : " << frameCount << " frames in " << chunks.size() << " chunks on "
+		<< threadCount << " threads, " << columns.size() << " faces in " << ofToString(elapsedSeconds, 2) << " s";
+	if (failedCount > 0)
+	{
+		ofLogError("KinectBatchProcessor") << path << " : " << failedCount << " of " << chunks.size() << " chunks could not be replayed";
+		return false;
+	}
+	return true;
+}
+
+// replays the chunk's frames and the warmup before them, the filters restart with every chunk
+// so that a chunk's results never depend on the ones before it
+void KinectBatchProcessor::processChunk(Chunk& chunk)
+{
+	KinectReplaySource source(path, false, false);
+	if (!source.open(mode, KINECT_FRAME_BODY))
+	{
+		chunk.isFailed = true;
+		return;
+	}
+
+	const int start = MAX(chunk.first - settings.warmupFrames, 0);
+	source.setFrameIndex(start);
+
+	UINT64 trackingIds[BODY_COUNT] = {0};
+	UINT64 filteredIds[BODY_COUNT] = {0};
+	KinectRotationFilter rotationFilters[BODY_COUNT];
+	KinectOneEuroFilter positionFilters[BODY_COUNT];
+	KinectOneEuroFilter animationFilters[BODY_COUNT];
+	KinectFaceData faces[BODY_COUNT];
+	KinectHDFaceData hdFaces[BODY_COUNT];
+	memset(faces, 0, sizeof(faces));
+	memset(hdFaces, 0, sizeof(hdFaces));
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		// rect in color space pixels, or the head pivot in meters with speeds in mm/s
+		positionFilters[i].setup(mode == KINECT_SOURCE_FACE ? 4 : 3, mode == KINECT_SOURCE_FACE ? 1.f : 1000.f);
+		animationFilters[i].setup(FaceShapeAnimations_Count, 100.f);
+	}
+
+	for (int n = start; n < chunk.last; n++)
+	{
+		INT64 time = 0;
+		UINT64 ids[BODY_COUNT];
+		if (source.acquireBodies(ids, time))
+		{
+			memcpy(trackingIds, ids, sizeof(trackingIds));
+		}
+		if (source.getFrameIndex() != n)break;
+
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			faces[i].isActive = hdFaces[i].isActive = trackingIds[i] != 0;
+		}
+		if (mode == KINECT_SOURCE_FACE)
+		{
+			source.acquireFaces(faces);
+		}
+		else
+		{
+			source.acquireHDFaces(hdFaces);
+		}
+
+		const double seconds = time * 1e-7;
+		const bool isOutput = n >= chunk.first;
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			if (filteredIds[i] != trackingIds[i] || !settings.filter.isEnabled)
+			{
+				filteredIds[i] = trackingIds[i];
+				rotationFilters[i].reset();
+				positionFilters[i].reset();
+				animationFilters[i].reset();
+			}
+
+			Vector4 rotation;
+			float position[4];
+			float animationUnits[FaceShapeAnimations_Count];
+			if (mode == KINECT_SOURCE_FACE)
+			{
+				const KinectFaceData& face = faces[i];
+				if (!face.isUpdated || KinectValidateFace(face, COLOR_WIDTH, COLOR_HEIGHT, features) != KINECT_FACE_ACCEPTED)continue;
+
+				rotation = face.rotation;
+				position[0] = face.boundingBox.Left;
+				position[1] = face.boundingBox.Top;
+				position[2] = face.boundingBox.Right - face.boundingBox.Left;
+				position[3] = face.boundingBox.Bottom - face.boundingBox.Top;
+			}
+			else
+			{
+				const KinectHDFaceData& face = hdFaces[i];
+				if (!face.isUpdated || KinectValidateHDFace(face, projection, COLOR_WIDTH, COLOR_HEIGHT) != KINECT_FACE_ACCEPTED)continue;
+
+				rotation = face.orientation;
+				position[0] = face.headPivot.X;
+				position[1] = face.headPivot.Y;
+				position[2] = face.headPivot.Z;
+				memcpy(animationUnits, face.animationUnits, sizeof(animationUnits));
+			}
+
+			if (settings.filter.isEnabled)
+			{
+				rotationFilters[i].update(&rotation.x, seconds, settings.filter);
+				positionFilters[i].update(position, seconds, settings.filter);
+				if (mode == KINECT_SOURCE_HD_FACE)
+				{
+					animationFilters[i].update(animationUnits, seconds, settings.filter);
+				}
+			}
+			if (!isOutput)continue;
+
+			const float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+			const float pitch = atan2(2 * (y * z + w * x), w * w - x * x - y * y + z * z) / PI * 180.f;
+			const float yaw = asin(ofClamp(2 * (w * y - x * z), -1.f, 1.f)) / PI * 180.f;
+			const float roll = atan2(2 * (x * y + w * z), w * w + x * x - y * y - z * z) / PI * 180.f;
+
+			KinectBatchColumns& out = chunk.columns;
+			KinectBatchMetrics& stats = chunk.metrics;
+			out.frame.push_back(n);
+			out.time.push_back(time);
+			out.slot.push_back(i);
+			out.trackingId.push_back(trackingIds[i]);
+			out.yaw.push_back(yaw);
+			out.pitch.push_back(pitch);
+			out.roll.push_back(roll);
+			stats.faceFrames++;
+			stats.yawHistogram[angleBin(yaw)]++;
+			stats.pitchHistogram[angleBin(pitch)]++;
+			stats.rollHistogram[angleBin(roll)]++;
+
+			if (mode == KINECT_SOURCE_FACE)
+			{
+				out.colorX.push_back(position[0] + position[2] * 0.5f);
+				out.colorY.push_back(position[1] + position[3] * 0.5f);
+				// properties that were not recorded leave their columns out
+				for (int j = 0; (features & KINECT_FACE_FEATURE_PROPERTIES) && j < FaceProperty::FaceProperty_Count; j++)
+				{
+					const DetectionResult result = faces[i].properties[j];
+					out.properties[j].push_back(result);
+					if (result >= 0 && result <= DetectionResult::DetectionResult_Maybe)stats.propertyCounts[j][result]++;
+				}
+			}
+			else
+			{
+				CameraSpacePoint pivot = { position[0], position[1], position[2] };
+				ColorSpacePoint color;
+				projection.project(&pivot, &color, 1);
+				out.colorX.push_back(color.X);
+				out.colorY.push_back(color.Y);
+				out.pivotX.push_back(pivot.X);
+				out.pivotY.push_back(pivot.Y);
+				out.pivotZ.push_back(pivot.Z);
+				for (int j = 0; j < FaceShapeAnimations_Count; j++)
+				{
+					out.animationUnits[j].push_back(animationUnits[j]);
+					stats.animationSum[j] += animationUnits[j];
+					stats.animationSquares[j] += animationUnits[j] * animationUnits[j];
+				}
+			}
+		}
+	}
+}
+
+bool KinectBatchProcessor::save(const std::string& path) const
+{
+	FILE* file = fopen(ofToDataPath(path).c_str(), "wb");
+	if (!file)
+	{
+		ofLogError("KinectBatchProcessor") << "could not open " << path;
+		return false;
+	}
+
+	const size_t rows = columns.size();
+	ColumnFileHeader header;
+	memcpy(header.magic, COLUMN_MAGIC, sizeof(header.magic));
+	header.version = COLUMN_VERSION;
+	header.rowCount = rows;
+	header.columnCount = 4 + countColumn(columns.yaw, rows) * 5 + countColumn(columns.pivotX, rows) * 3;
+	header.reserved = 0;
+	for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+	{
+		header.columnCount += countColumn(columns.properties[j], rows);
+	}
+	for (int j = 0; j < FaceShapeAnimations_Count; j++)
+	{
+		header.columnCount += countColumn(columns.animationUnits[j], rows);
+	}
+
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1
+		&& writeColumn(file, "frame", COLUMN_INT32, columns.frame, rows)
+		&& writeColumn(file, "time", COLUMN_INT64, columns.time, rows)
+		&& writeColumn(file, "slot", COLUMN_INT32, columns.slot, rows)
+		&& writeColumn(file, "trackingId", COLUMN_UINT64, columns.trackingId, rows)
+		&& writeColumn(file, "yaw", COLUMN_FLOAT32, columns.yaw, rows)
+		&& writeColumn(file, "pitch", COLUMN_FLOAT32, columns.pitch, rows)
+		&& writeColumn(file, "roll", COLUMN_FLOAT32, columns.roll, rows)
+		&& writeColumn(file, "colorX", COLUMN_FLOAT32, columns.colorX, rows)
+		&& writeColumn(file, "colorY", COLUMN_FLOAT32, columns.colorY, rows)
+		&& writeColumn(file, "pivotX", COLUMN_FLOAT32, columns.pivotX, rows)
+		&& writeColumn(file, "pivotY", COLUMN_FLOAT32, columns.pivotY, rows)
+		&& writeColumn(file, "pivotZ", COLUMN_FLOAT32, columns.pivotZ, rows);
+	for (int j = 0; isWritten && j < FaceProperty::FaceProperty_Count; j++)
+	{
+		isWritten = writeColumn(file, PROPERTY_NAMES[j], COLUMN_UINT8, columns.properties[j], rows);
+	}
+	for (int j = 0; isWritten && j < FaceShapeAnimations_Count; j++)
+	{
+		isWritten = writeColumn(file, ANIMATION_NAMES[j], COLUMN_FLOAT32, columns.animationUnits[j], rows);
+	}
+	fclose(file);
+	return isWritten;
+}
+
+const KinectBatchColumns& KinectBatchProcessor::getColumns() const
+{
+	return columns;
+}
+
+const KinectBatchMetrics& KinectBatchProcessor::getMetrics() const
+{
+	return metrics;
+}
+
+int KinectBatchProcessor::getFrameCount() const
+{
+	return frameCount;
+}
+
+double KinectBatchProcessor::getElapsedSeconds() const
+{
+	return elapsedSeconds;
+}
@@ -0,0 +1,115 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofxKinectFaceGroup.h"
+
+struct KinectBatchSettings
+{
+	int threadCount;            // 0 uses one per hardware thread, 1 runs on the calling thread only
+	int chunkFrames;            // frames per task, the output does not depend on the thread count
+	int warmupFrames;           // frames before each chunk that only settle the filters
+	KinectFilterSettings filter;
+
+	KinectBatchSettings();
+};
+
+// one entry per valid face and frame in every column, in frame then slot order.
+// face mode fills properties, hd face mode fills the pivot and the animation units
+struct KinectBatchColumns
+{
+	std::vector<INT32> frame;
+	std::vector<INT64> time;
+	std::vector<INT32> slot;
+	std::vector<UINT64> trackingId;
+	std::vector<float> yaw;   // degrees
+	std::vector<float> pitch;
+	std::vector<float> roll;
+	std::vector<float> colorX; // face rect center or mapped head pivot in color space pixels
+	std::vector<float> colorY;
+	std::vector<float> pivotX; // head pivot in meters
+	std::vector<float> pivotY;
+	std::vector<float> pivotZ;
+	std::vector<BYTE> properties[FaceProperty::FaceProperty_Count]; // DetectionResult
+	std::vector<float> animationUnits[FaceShapeAnimations_Count];
+
+	size_t size() const { return frame.size(); }
+	void clear();
+	void append(const KinectBatchColumns& other);
+};
+
+// 5 degree bins from -90 to 90 degrees
+static const int KINECT_BATCH_ANGLE_BINS = 36;
+
+// statistics over all valid faces, merged in chunk order so that the sums are reproducible
+struct KinectBatchMetrics
+{
+	UINT64 faceFrames;
+	double animationSum[FaceShapeAnimations_Count];
+	double animationSquares[FaceShapeAnimations_Count];
+	UINT64 propertyCounts[FaceProperty::FaceProperty_Count][DetectionResult::DetectionResult_Maybe + 1];
+	UINT64 yawHistogram[KINECT_BATCH_ANGLE_BINS];
+	UINT64 pitchHistogram[KINECT_BATCH_ANGLE_BINS];
+	UINT64 rollHistogram[KINECT_BATCH_ANGLE_BINS];
+
+	KinectBatchMetrics();
+	void clear();
+	void merge(const KinectBatchMetrics& other);
+	float getAnimationMean(FaceShapeAnimations unit) const;
+	float getAnimationDeviation(FaceShapeAnimations unit) const;
+	// share of faces with a yes, engagement is FaceProperty_Engaged
+	float getPropertyRate(FaceProperty property) const;
+	std::string getSummary() const;
+};
+
+#pragma mark - KinectBatchProcessor
+
+// runs the face post-processing of a recording as fast as the cores allow. the recording is cut
+// into chunks of fixed length that are filtered, mapped and measured on a worker pool, each with its
+// own replay of the memory mapped file, and the results are joined in frame order
+class KinectBatchProcessor
+{
+public:
+	KinectBatchProcessor();
+
+	void setSettings(const KinectBatchSettings& settings);
+	const KinectBatchSettings& getSettings() const;
+	// false when the recording cannot be opened in this mode or any chunk failed, the columns then miss frames
+	bool process(const std::string& path, KinectSourceMode mode);
+	// one contiguous block per column, see KinectBatchColumns
+	bool save(const std::string& path) const;
+
+	const KinectBatchColumns& getColumns() const;
+	const KinectBatchMetrics& getMetrics() const;
+	int getFrameCount() const;
+	// wall clock time of the last process() call
+	double getElapsedSeconds() const;
+
+private:
+	struct Chunk
+	{
+		int first;
+		int last;
+		bool isFailed; // its replay could not be opened, the chunk has no rows
+		KinectBatchColumns columns;
+		KinectBatchMetrics metrics;
+	};
+
+	void processChunk(Chunk& chunk);
+
+	KinectBatchSettings settings;
+	std::string path;
+	KinectSourceMode mode;
+	KinectColorProjection projection;
+	DWORD features; // as recorded, outputs that were not requested are not validated
+	KinectBatchColumns columns;
+	KinectBatchMetrics metrics;
+	int frameCount;
+	double elapsedSeconds;
+};
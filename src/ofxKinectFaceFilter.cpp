@@ -0,0 +1,127 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceFilter.h"
+
+// frames closer than this or further apart than MAX_FRAME_GAP restart the filter's time base
+static const double MIN_FRAME_GAP = 0.001;
+static const double MAX_FRAME_GAP = 0.5;
+
+// smoothing factor of a first order low pass at cutoff hz
+static inline float smoothing(double dt, float cutoff)
+{
+	float tau = 1.f / (TWO_PI * cutoff);
+	return 1.f / (1.f + tau / dt);
+}
+
+KinectFilterSettings::KinectFilterSettings()
+	: isEnabled(false)
+	, minCutoff(1.f)
+	, beta(0.01f)
+	, derivativeCutoff(1.f)
+	, prediction(0.f)
+	, isVertexFiltered(false)
+{
+}
+
+#pragma mark - KinectOneEuroFilter
+
+KinectOneEuroFilter::KinectOneEuroFilter()
+	: speedScale(1.f)
+	, lastTime(0.0)
+	, hasValue(false)
+{
+}
+
+void KinectOneEuroFilter::setup(int channelCount, float speedScale)
+{
+	value.assign(channelCount, 0.f);
+	derivative.assign(channelCount, 0.f);
+	this->speedScale = speedScale;
+	hasValue = false;
+}
+
+void KinectOneEuroFilter::reset()
+{
+	hasValue = false;
+}
+
+void KinectOneEuroFilter::update(float* values, double time, const KinectFilterSettings& settings)
+{
+	const size_t count = value.size();
+	double dt = time - lastTime;
+	if (!hasValue || dt < MIN_FRAME_GAP || dt > MAX_FRAME_GAP)
+	{
+		memcpy(value.data(), values, sizeof(float) * count);
+		std::fill(derivative.begin(), derivative.end(), 0.f);
+		lastTime = time;
+		hasValue = true;
+		return;
+	}
+	lastTime = time;
+
+	const float invDt = 1.f / dt;
+	const float derivativeAlpha = smoothing(dt, settings.derivativeCutoff);
+	for (size_t k = 0; k < count; k++)
+	{
+		float dx = (values[k] - value[k]) * invDt;
+		derivative[k] += derivativeAlpha * (dx - derivative[k]);
+		float cutoff = settings.minCutoff + settings.beta * fabsf(derivative[k]) * speedScale;
+		value[k] += smoothing(dt, cutoff) * (values[k] - value[k]);
+		values[k] = value[k] + derivative[k] * settings.prediction;
+	}
+}
+
+#pragma mark - KinectRotationFilter
+
+KinectRotationFilter::KinectRotationFilter()
+	: speed(0.f)
+	, lastTime(0.0)
+	, hasValue(false)
+{
+}
+
+void KinectRotationFilter::reset()
+{
+	hasValue = false;
+}
+
+void KinectRotationFilter::update(float* q, double time, const KinectFilterSettings& settings)
+{
+	ofQuaternion raw(q[0], q[1], q[2], q[3]);
+	double dt = time - lastTime;
+	if (!hasValue || dt < MIN_FRAME_GAP || dt > MAX_FRAME_GAP)
+	{
+		value = raw;
+		speed = 0.f;
+		lastTime = time;
+		hasValue = true;
+		return;
+	}
+	lastTime = time;
+
+	float dot = fabsf(value.asVec4().dot(raw.asVec4()));
+	float angle = 2.f * acosf(MIN(dot, 1.f)) * RAD_TO_DEG;
+	speed += smoothing(dt, settings.derivativeCutoff) * (angle / dt - speed);
+	float cutoff = settings.minCutoff + settings.beta * speed;
+
+	ofQuaternion previous = value;
+	value.slerp(smoothing(dt, cutoff), previous, raw);
+
+	// continues along the arc of the last filtered step
+	ofQuaternion result = value;
+	if (settings.prediction > 0.f)
+	{
+		result.slerp(1.f + settings.prediction / dt, previous, value);
+	}
+	ofVec4f v = result.asVec4().getNormalized();
+	q[0] = v.x;
+	q[1] = v.y;
+	q[2] = v.z;
+	q[3] = v.w;
+}
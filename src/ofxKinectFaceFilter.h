@@ -0,0 +1,66 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofMain.h"
+
+// one euro filter parameters, speeds are in pixels/s for color space values,
+// mm/s for camera space values, 1/100 per second for animation units and degrees/s for rotations
+struct KinectFilterSettings
+{
+	bool isEnabled;
+	float minCutoff;        // hz, lower is smoother while still
+	float beta;             // cutoff gain per unit of speed, higher follows fast motion with less lag
+	float derivativeCutoff; // hz, smoothing of the speed estimate
+	float prediction;       // seconds to extrapolate, covers the sensor to render latency
+	bool isVertexFiltered;  // hd face vertices, by far the most channels
+
+	KinectFilterSettings();
+};
+
+#pragma mark - KinectOneEuroFilter
+
+// one euro filter over a fixed number of channels that share a time base
+class KinectOneEuroFilter
+{
+public:
+	KinectOneEuroFilter();
+
+	// speedScale converts channel units to the units of KinectFilterSettings::beta
+	void setup(int channelCount, float speedScale = 1.f);
+	void reset();
+	// filters values in place, time in seconds
+	void update(float* values, double time, const KinectFilterSettings& settings);
+
+private:
+	std::vector<float> value;
+	std::vector<float> derivative;
+	float speedScale;
+	double lastTime;
+	bool hasValue;
+};
+
+#pragma mark - KinectRotationFilter
+
+// one euro filter on the angular speed of a quaternion, smoothed with slerp
+class KinectRotationFilter
+{
+public:
+	KinectRotationFilter();
+
+	void reset();
+	// filters q in place, time in seconds
+	void update(float* q, double time, const KinectFilterSettings& settings);
+
+private:
+	ofQuaternion value;
+	float speed; // degrees per second
+	double lastTime;
+	bool hasValue;
+};
@@ -0,0 +1,350 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceGroup.h"
+
+static const float DEFAULT_MERGE_DISTANCE = 0.25f;
+static const size_t MAX_SENSORS = 32;
+
+#pragma mark - KinectWorkerPool
+
+KinectWorkerPool::KinectWorkerPool()
+	: pending(0)
+	, queued(0)
+	, nextQueue(0)
+	, isRunning(false)
+{
+}
+
+KinectWorkerPool::~KinectWorkerPool()
+{
+	close();
+}
+
+void KinectWorkerPool::setup(int threadCount)
+{
+	close();
+
+	if (threadCount <= 0)
+	{
+		threadCount = MAX((int)std::thread::hardware_concurrency(), 1);
+	}
+
+	// the last queue belongs to the thread calling wait()
+	for (int i = 0; i <= threadCount; i++)
+	{
+		queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+	}
+	isRunning = true;
+	for (int i = 0; i < threadCount; i++)
+	{
+		threads.push_back(std::thread(&KinectWorkerPool::run, this, i));
+	}
+}
+
+void KinectWorkerPool::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		isRunning = false;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	threads.clear();
+	queues.clear();
+	pending = 0;
+	queued = 0;
+}
+
+int KinectWorkerPool::getThreadCount()
+{
+	return threads.size();
+}
+
+void KinectWorkerPool::push(const std::function<void()>& task)
+{
+	if (queues.empty())
+	{
+		task();
+		return;
+	}
+
+	TaskQueue& queue = *queues[nextQueue++ % queues.size()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		pending++;
+		queued++;
+	}
+	wake.notify_one();
+}
+
+void KinectWorkerPool::wait()
+{
+	const int worker = (int)queues.size() - 1;
+	std::function<void()> task;
+	while (worker >= 0 && pop(worker, task))
+	{
+		task();
+		if (--pending == 0)
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			done.notify_all();
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(wakeMutex);
+	done.wait(lock, [this]{ return pending == 0; });
+}
+
+void KinectWorkerPool::run(int worker)
+{
+	std::function<void()> task;
+	while (true)
+	{
+		if (pop(worker, task))
+		{
+			task();
+			if (--pending == 0)
+			{
+				std::lock_guard<std::mutex> lock(wakeMutex);
+				done.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		wake.wait(lock, [this]{ return !isRunning || queued > 0; });
+		if (!isRunning)return;
+	}
+}
+
+// own queue from the back, then the front of the others
+bool KinectWorkerPool::pop(int worker, std::function<void()>& task)
+{
+	{
+		TaskQueue& queue = *queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+
+	for (size_t k = 1; k < queues.size(); k++)
+	{
+		TaskQueue& queue = *queues[(worker + k) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+#pragma mark - KinectFaceGroup
+
+KinectFaceGroup::KinectFaceGroup()
+	: mergeDistance(DEFAULT_MERGE_DISTANCE)
+	, isHeadless(false)
+{
+}
+
+KinectFaceGroup::~KinectFaceGroup()
+{
+	close();
+}
+
+void KinectFaceGroup::setup(int threadCount)
+{
+	pool.setup(threadCount);
+}
+
+void KinectFaceGroup::setHeadless(bool isHeadless)
+{
+	this->isHeadless = isHeadless;
+}
+
+int KinectFaceGroup::addSource(KinectFrameSource* source, const ofMatrix4x4& extrinsics)
+{
+	// one bit per sensor in KinectWorldFace::sensorMask
+	if (sensors.size() >= MAX_SENSORS)
+	{
+		ofLogError("KinectFaceGroup") << "at most " << MAX_SENSORS << " sensors are supported";
+		delete source;
+		return -1;
+	}
+
+	// the pool acts as the worker thread of every sensor, so update() only swaps buffers
+	std::unique_ptr<Sensor> sensor(new Sensor());
+	sensor->face.reset(new ofxKinectHDFace());
+	sensor->face->setRequiredFrames(KINECT_FRAME_BODY | KINECT_FRAME_FACE);
+	sensor->face->setExternallyDriven(true);
+	sensor->face->setHeadless(isHeadless);
+	if (!sensor->face->setup(source))
+	{
+		ofLogError("KinectFaceGroup") << "sensor " << sensors.size() << " could not be opened and is not added";
+		return -1;
+	}
+	sensor->extrinsics = extrinsics;
+	sensor->hasSnapshot = false;
+	sensor->isNew = false;
+	sensors.push_back(std::move(sensor));
+	return sensors.size() - 1;
+}
+
+void KinectFaceGroup::setExtrinsics(int sensor, const ofMatrix4x4& extrinsics)
+{
+	if (sensor >= 0 && sensor < sensors.size())
+	{
+		sensors[sensor]->extrinsics = extrinsics;
+	}
+}
+
+void KinectFaceGroup::setMergeDistance(float meters)
+{
+	mergeDistance = meters;
+}
+
+int KinectFaceGroup::update()
+{
+	for (size_t s = 0; s < sensors.size(); s++)
+	{
+		Sensor* sensor = sensors[s].get();
+		sensor->isNew = false;
+		pool.push([sensor]
+		{
+			if (!sensor->face->acquireExternalFrame())return;
+
+			sensor->isNew = true;
+			sensor->hasSnapshot = sensor->face->getSnapshot(sensor->snapshot);
+		});
+	}
+	pool.wait();
+
+	int newCount = 0;
+	for (size_t s = 0; s < sensors.size(); s++)
+	{
+		// swaps in the frame the pool published
+		sensors[s]->face->update();
+		if (sensors[s]->isNew)newCount++;
+	}
+	if (newCount > 0)
+	{
+		merge();
+	}
+	return newCount;
+}
+
+// greedy clustering from the closest views out, a sensor contributes at most once per person
+void KinectFaceGroup::merge()
+{
+	observations.clear();
+	for (size_t s = 0; s < sensors.size(); s++)
+	{
+		const Sensor& sensor = *sensors[s];
+		if (!sensor.hasSnapshot)continue;
+
+		ofQuaternion sensorRotation = sensor.extrinsics.getRotate();
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			if (!sensor.snapshot.isValid[i])continue;
+
+			const CameraSpacePoint& p = sensor.snapshot.headPivot[i];
+			const Vector4& q = sensor.snapshot.rotation[i];
+			KinectWorldFace face;
+			face.sensor = s;
+			face.slot = i;
+			face.trackingId = sensor.snapshot.trackingId[i];
+			face.personId = sensor.snapshot.personId[i];
+			face.position = ofVec3f(p.X, p.Y, p.Z) * sensor.extrinsics;
+			face.rotation = ofQuaternion(q.x, q.y, q.z, q.w) * sensorRotation;
+			face.distance = p.Z;
+			face.sensorMask = 1u << s;
+			face.sensorCount = 1;
+			observations.push_back(face);
+		}
+	}
+	std::sort(observations.begin(), observations.end(), [](const KinectWorldFace& a, const KinectWorldFace& b)
+	{
+		return a.distance < b.distance;
+	});
+
+	faces.clear();
+	const float mergeDistanceSquared = mergeDistance * mergeDistance;
+	for (size_t n = 0; n < observations.size(); n++)
+	{
+		const KinectWorldFace& observation = observations[n];
+		int match = -1;
+		float best = mergeDistanceSquared;
+		for (size_t k = 0; k < faces.size(); k++)
+		{
+			if (faces[k].sensorMask & observation.sensorMask)continue;
+
+			float d = faces[k].position.squareDistance(observation.position);
+			if (d < best)
+			{
+				best = d;
+				match = k;
+			}
+		}
+
+		if (match < 0)
+		{
+			faces.push_back(observation);
+			continue;
+		}
+
+		// the closest view keeps its slot and rotation, positions are averaged
+		KinectWorldFace& face = faces[match];
+		face.position = (face.position * face.sensorCount + observation.position) / (face.sensorCount + 1);
+		face.sensorMask |= observation.sensorMask;
+		face.sensorCount++;
+	}
+}
+
+void KinectFaceGroup::close()
+{
+	pool.close();
+	sensors.clear();
+	faces.clear();
+}
+
+int KinectFaceGroup::getSensorCount()
+{
+	return sensors.size();
+}
+
+ofxKinectHDFace& KinectFaceGroup::getSensor(int sensor)
+{
+	return *sensors[sensor]->face;
+}
+
+const ofMatrix4x4& KinectFaceGroup::getExtrinsics(int sensor)
+{
+	return sensors[sensor]->extrinsics;
+}
+
+// valid until the next update()
+const std::vector<KinectWorldFace>& KinectFaceGroup::getFaces()
+{
+	return faces;
+}
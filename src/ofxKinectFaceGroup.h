@@ -0,0 +1,119 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofxKinectFace.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#pragma mark - KinectWorkerPool
+
+// fixed set of workers with one task queue each, idle workers steal from the others
+class KinectWorkerPool
+{
+public:
+	KinectWorkerPool();
+	~KinectWorkerPool();
+
+	// 0 uses one worker per hardware thread
+	void setup(int threadCount = 0);
+	void close();
+	int getThreadCount();
+
+	// queues are filled round robin, a worker takes its newest task and steals the oldest of others
+	void push(const std::function<void()>& task);
+	// runs queued tasks on the calling thread too and returns once all of them finished
+	void wait();
+
+private:
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	void run(int worker);
+	bool pop(int worker, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<TaskQueue> > queues;
+	std::vector<std::thread> threads;
+	std::atomic<int> pending; // queued or running
+	std::atomic<int> queued;  // raised under wakeMutex so idle workers never miss a push
+	std::atomic<unsigned> nextQueue;
+	bool isRunning;
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+};
+
+#pragma mark - KinectFaceGroup
+
+// one face of the merged world space list
+struct KinectWorldFace
+{
+	int sensor;          // sensor with the closest view, its slot, tracking id and person
+	int slot;
+	UINT64 trackingId;
+	UINT32 personId;     // persons are kept per sensor, see KinectBase::getPersons()
+	ofVec3f position;    // head pivot in world space, averaged over every sensor that sees the face
+	ofQuaternion rotation;
+	float distance;      // from the closest sensor in meters
+	UINT32 sensorMask;   // bit per sensor that sees the face
+	int sensorCount;
+};
+
+// runs several hd face pipelines on a shared worker pool and merges their faces
+// into one world space list, color is never consumed
+class KinectFaceGroup
+{
+public:
+	KinectFaceGroup();
+	~KinectFaceGroup();
+
+	// 0 uses one worker per hardware thread
+	void setup(int threadCount = 0);
+	// sensors added afterwards never allocate textures or meshes, see KinectBase::setHeadless()
+	void setHeadless(bool isHeadless);
+	// takes ownership of source, extrinsics map the sensor's camera space to world space.
+	// returns the sensor index, or -1 when the source could not be opened or 32 sensors are added
+	int addSource(KinectFrameSource* source, const ofMatrix4x4& extrinsics = ofMatrix4x4());
+	void setExtrinsics(int sensor, const ofMatrix4x4& extrinsics);
+	// faces of different sensors closer than this are the same person
+	void setMergeDistance(float meters);
+	// acquires every sensor once on the pool, then merges, returns the number of sensors with a new frame
+	int update();
+	void close();
+
+	int getSensorCount();
+	ofxKinectHDFace& getSensor(int sensor);
+	const ofMatrix4x4& getExtrinsics(int sensor);
+	const std::vector<KinectWorldFace>& getFaces();
+
+private:
+	struct Sensor
+	{
+		std::unique_ptr<ofxKinectHDFace> face;
+		ofMatrix4x4 extrinsics;
+		KinectHDFaceSnapshot snapshot;
+		bool hasSnapshot;
+		bool isNew;
+	};
+
+	void merge();
+
+	KinectWorkerPool pool;
+	std::vector<std::unique_ptr<Sensor> > sensors;
+	float mergeDistance;
+	bool isHeadless;
+	std::vector<KinectWorldFace> observations; // scratch, one per valid face and sensor
+	std::vector<KinectWorldFace> faces;
+};
@@ -0,0 +1,106 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceLod.h"
+#include <unordered_set>
+
+// greedy cover in vertex order, each new cluster claims what lies within radius hops
+// unless another cluster's center is closer
+static void clusterVertices(const std::vector<std::vector<UINT32> >& neighbours, int radius, KinectMeshLod& lod)
+{
+	const UINT32 vertexCount = neighbours.size();
+	std::vector<int> hops(vertexCount, INT_MAX);
+	std::vector<UINT32> queue;
+	lod.parents.assign(vertexCount, 0);
+	lod.vertices.clear();
+
+	for (UINT32 v = 0; v < vertexCount; v++)
+	{
+		if (hops[v] != INT_MAX)continue;
+
+		const UINT32 cluster = lod.vertices.size();
+		lod.vertices.push_back(v);
+		lod.parents[v] = cluster;
+		hops[v] = 0;
+
+		queue.assign(1, v);
+		for (size_t head = 0; head < queue.size(); head++)
+		{
+			const UINT32 u = queue[head];
+			if (hops[u] >= radius)continue;
+
+			for (size_t n = 0; n < neighbours[u].size(); n++)
+			{
+				const UINT32 w = neighbours[u][n];
+				if (hops[w] <= hops[u] + 1)continue;
+
+				hops[w] = hops[u] + 1;
+				lod.parents[w] = cluster;
+				queue.push_back(w);
+			}
+		}
+	}
+}
+
+// maps the triangles onto the clusters, keeping the winding and dropping collapsed and repeated ones
+static void collapseTriangles(const std::vector<UINT32>& triangles, KinectMeshLod& lod)
+{
+	const UINT64 n = lod.vertices.size();
+	std::unordered_set<UINT64> kept;
+	lod.indices.clear();
+	for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+	{
+		UINT64 a = lod.parents[triangles[t]];
+		UINT64 b = lod.parents[triangles[t + 1]];
+		UINT64 c = lod.parents[triangles[t + 2]];
+		if(a == b || b == c || a == c)continue;
+
+		UINT64 lo = MIN(a, MIN(b, c));
+		UINT64 hi = MAX(a, MAX(b, c));
+		UINT64 mid = a + b + c - lo - hi;
+		if (!kept.insert((lo * n + mid) * n + hi).second)continue;
+
+		lod.indices.push_back(a);
+		lod.indices.push_back(b);
+		lod.indices.push_back(c);
+	}
+}
+
+void KinectBuildMeshLods(UINT32 vertexCount, const std::vector<UINT32>& triangles, KinectMeshLod* lods)
+{
+	std::vector<std::vector<UINT32> > neighbours(vertexCount);
+	for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+	{
+		for (int e = 0; e < 3; e++)
+		{
+			const UINT32 a = triangles[t + e];
+			const UINT32 b = triangles[t + (e + 1) % 3];
+			if(a >= vertexCount || b >= vertexCount || a == b)continue;
+
+			neighbours[a].push_back(b);
+			neighbours[b].push_back(a);
+		}
+	}
+
+	KinectMeshLod& full = lods[0];
+	full.vertices.resize(vertexCount);
+	full.parents.resize(vertexCount);
+	for (UINT32 v = 0; v < vertexCount; v++)
+	{
+		full.vertices[v] = full.parents[v] = v;
+	}
+	full.indices.assign(triangles.begin(), triangles.end());
+
+	for (int l = 1; l < KINECT_MESH_LOD_COUNT; l++)
+	{
+		clusterVertices(neighbours, 1 << (l - 1), lods[l]);
+		collapseTriangles(triangles, lods[l]);
+		ofLogVerbose("KinectBuildMeshLods") << "level " << l << " : " << lods[l].vertices.size() << " vertices, "
+			<< lods[l].indices.size() / 3 << " triangles";
+	}
+}
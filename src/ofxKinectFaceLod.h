@@ -0,0 +1,28 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofMain.h"
+#include "ofxKinectFaceSource.h"
+
+// full detail, about a quarter and about a tenth of the hd face vertices
+static const int KINECT_MESH_LOD_COUNT = 3;
+
+// a decimated hd face topology whose vertices are a subset of the full model
+struct KinectMeshLod
+{
+	std::vector<UINT32> vertices;     // full model index of each kept vertex
+	std::vector<ofIndexType> indices; // triangles over the kept vertices
+	std::vector<UINT32> parents;      // kept vertex standing in for each full model vertex
+};
+
+// builds all levels from the topology alone, so they are ready before the first face arrives.
+// every level clusters the vertices within twice the edge hops of the level before and drops
+// the triangles that collapse
+void KinectBuildMeshLods(UINT32 vertexCount, const std::vector<UINT32>& triangles, KinectMeshLod* lods);
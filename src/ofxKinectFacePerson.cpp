@@ -0,0 +1,265 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFacePerson.h"
+
+static const INT64 TICKS_PER_SECOND = 10000000;
+
+// rms difference of two shapes' deformations
+static float shapeDistance(const KinectFaceModel& a, const KinectFaceModel& b)
+{
+	float sum = 0.f;
+	for (int i = 0; i < FaceShapeDeformations_Count; i++)
+	{
+		float d = a.deformations[i] - b.deformations[i];
+		sum += d * d;
+	}
+	return sqrtf(sum / FaceShapeDeformations_Count);
+}
+
+KinectPerson::KinectPerson()
+	: id(0)
+	, trackingId(0)
+	, slot(-1)
+	, lastSeen(0)
+	, hasShape(false)
+{
+}
+
+#pragma mark - KinectPersonRegistry
+
+KinectPersonRegistry::KinectPersonRegistry()
+	: nextId(1)
+	, retention(300 * TICKS_PER_SECOND)
+	, forgetTime(0)
+	, lastTime(0)
+	, matchDistance(0.1f)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		slotPersons[i] = 0;
+	}
+}
+
+void KinectPersonRegistry::setRetention(float seconds)
+{
+	ofScopedLock lock(mutex);
+	retention = (INT64)(seconds * TICKS_PER_SECOND);
+}
+
+void KinectPersonRegistry::setMatchDistance(float distance)
+{
+	ofScopedLock lock(mutex);
+	matchDistance = distance;
+}
+
+void KinectPersonRegistry::clear()
+{
+	ofScopedLock lock(mutex);
+	persons.clear();
+	trackedPersons.clear();
+	forgetTime = lastTime = 0;
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		slotPersons[i] = 0;
+	}
+}
+
+void KinectPersonRegistry::update(const UINT64* trackingIds, INT64 time)
+{
+	ofScopedLock lock(mutex);
+	lastTime = time;
+
+	UINT32 previous[BODY_COUNT];
+	memcpy(previous, slotPersons, sizeof(previous));
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		slotPersons[i] = 0;
+		if (!trackingIds[i])continue;
+
+		std::unordered_map<UINT64, UINT32>::const_iterator tracked = trackedPersons.find(trackingIds[i]);
+		UINT32 id = tracked != trackedPersons.end() ? tracked->second : 0;
+		if (!id)
+		{
+			id = nextId++;
+			persons[id].id = id;
+			persons[id].trackingId = trackingIds[i];
+			trackedPersons[trackingIds[i]] = id;
+		}
+		KinectPerson& person = persons[id];
+		person.slot = i;
+		person.lastSeen = time;
+		slotPersons[i] = id;
+	}
+
+	// the sensor never reuses a tracking id, so a lost body is gone for good
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		std::unordered_map<UINT32, KinectPerson>::iterator it = persons.find(previous[i]);
+		if (it == persons.end())continue;
+
+		KinectPerson& person = it->second;
+		if (person.slot >= 0 && slotPersons[person.slot] == person.id)continue;
+
+		trackedPersons.erase(person.trackingId);
+		person.trackingId = 0;
+		person.slot = -1;
+		// nothing could ever recognize an unnamed person without a shape
+		if (!person.hasShape && person.name.empty())
+		{
+			persons.erase(it);
+		}
+	}
+
+	forget(time);
+}
+
+// drops departed persons after the retention time, checked once per second
+void KinectPersonRegistry::forget(INT64 time)
+{
+	if (time < forgetTime)return;
+
+	forgetTime = time + TICKS_PER_SECOND;
+	std::unordered_map<UINT32, KinectPerson>::iterator it = persons.begin();
+	while (it != persons.end())
+	{
+		const KinectPerson& person = it->second;
+		if (person.slot < 0 && time - person.lastSeen > retention)
+		{
+			if (person.trackingId)trackedPersons.erase(person.trackingId);
+			it = persons.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+UINT32 KinectPersonRegistry::identify(int slot, const KinectFaceModel& shape)
+{
+	if(slot<0 || slot>=BODY_COUNT)return 0;
+
+	ofScopedLock lock(mutex);
+	UINT32 id = slotPersons[slot];
+	if (!id)return 0;
+
+	// only departed persons can be the one coming back
+	UINT32 returning = 0;
+	float bestDistance = matchDistance;
+	for (std::unordered_map<UINT32, KinectPerson>::const_iterator it = persons.begin(); it != persons.end(); ++it)
+	{
+		const KinectPerson& other = it->second;
+		if(other.slot >= 0 || !other.hasShape)continue;
+
+		float distance = shapeDistance(shape, other.shape);
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			returning = other.id;
+		}
+	}
+
+	KinectPerson& person = persons[id];
+	person.shape = shape;
+	person.hasShape = true;
+	if (returning)
+	{
+		merge(returning, id);
+		return returning;
+	}
+	return id;
+}
+
+void KinectPersonRegistry::setName(UINT64 trackingId, const std::string& name)
+{
+	if (trackingId == 0)return;
+
+	ofScopedLock lock(mutex);
+	std::unordered_map<UINT64, UINT32>::const_iterator tracked = trackedPersons.find(trackingId);
+	UINT32 id = tracked != trackedPersons.end() ? tracked->second : 0;
+	if (!id)
+	{
+		// named ahead of its first body frame, forgotten if the body never shows up
+		id = nextId++;
+		persons[id].id = id;
+		persons[id].trackingId = trackingId;
+		persons[id].lastSeen = lastTime;
+		trackedPersons[trackingId] = id;
+	}
+	persons[id].name = name;
+	if (name.empty())return;
+
+	for (std::unordered_map<UINT32, KinectPerson>::const_iterator it = persons.begin(); it != persons.end(); ++it)
+	{
+		const KinectPerson& other = it->second;
+		if (other.id != id && other.slot < 0 && other.trackingId == 0 && other.name == name)
+		{
+			merge(other.id, id);
+			return;
+		}
+	}
+}
+
+void KinectPersonRegistry::merge(UINT32 returning, UINT32 id)
+{
+	KinectPerson& target = persons[returning];
+	const KinectPerson& person = persons[id];
+	target.trackingId = person.trackingId;
+	target.slot = person.slot;
+	target.lastSeen = person.lastSeen;
+	if (person.hasShape)
+	{
+		target.shape = person.shape;
+		target.hasShape = true;
+	}
+	if (target.name.empty())
+	{
+		target.name = person.name;
+	}
+	if (target.trackingId)trackedPersons[target.trackingId] = returning;
+	if (target.slot >= 0)slotPersons[target.slot] = returning;
+	persons.erase(id);
+}
+
+UINT32 KinectPersonRegistry::getPersonId(int slot) const
+{
+	if(slot<0 || slot>=BODY_COUNT)return 0;
+
+	ofScopedLock lock(mutex);
+	return slotPersons[slot];
+}
+
+UINT32 KinectPersonRegistry::findPersonId(UINT64 trackingId) const
+{
+	ofScopedLock lock(mutex);
+	std::unordered_map<UINT64, UINT32>::const_iterator tracked = trackedPersons.find(trackingId);
+	return tracked != trackedPersons.end() ? tracked->second : 0;
+}
+
+void KinectPersonRegistry::getPersonIds(UINT32* personIds) const
+{
+	ofScopedLock lock(mutex);
+	memcpy(personIds, slotPersons, sizeof(slotPersons));
+}
+
+bool KinectPersonRegistry::getPerson(UINT32 id, KinectPerson& person) const
+{
+	ofScopedLock lock(mutex);
+	std::unordered_map<UINT32, KinectPerson>::const_iterator it = persons.find(id);
+	if (it == persons.end())return false;
+
+	person = it->second;
+	return true;
+}
+
+int KinectPersonRegistry::getPersonCount() const
+{
+	ofScopedLock lock(mutex);
+	return persons.size();
+}
@@ -0,0 +1,73 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofMain.h"
+#include <unordered_map>
+#include "ofxKinectFaceSource.h"
+
+// someone seen by the sensor, the id outlives the body's tracking id and slot
+struct KinectPerson
+{
+	UINT32 id;
+	UINT64 trackingId; // 0 while the person is not tracked
+	int slot;          // -1 while the person is not tracked
+	INT64 lastSeen;    // sensor time in 100ns units
+	bool hasShape;     // a fitted hd face model identifies the person when they come back
+	KinectFaceModel shape;
+	std::string name;  // optional, keys the face model cache
+
+	KinectPerson();
+};
+
+#pragma mark - KinectPersonRegistry
+
+// maps tracking ids to persistent person ids. tracking ids are looked up in constant time,
+// a fitted face shape or a name merges a returning person into the one seen before.
+// the id, name and shape survive tracking changes, smoothing and model fitting restart per body
+class KinectPersonRegistry
+{
+public:
+	KinectPersonRegistry();
+
+	// persons gone for longer than this are forgotten, in seconds
+	void setRetention(float seconds);
+	// largest rms difference of the shape deformations that still counts as the same person
+	void setMatchDistance(float distance);
+	void clear();
+
+	// assigns persons to the slots of a body frame, an unknown tracking id gets a new person
+	void update(const UINT64* trackingIds, INT64 time);
+	// the fitted shape of a slot's person, returns the person id after merging
+	UINT32 identify(int slot, const KinectFaceModel& shape);
+	// names the person behind a body, a departed person of the same name is merged
+	void setName(UINT64 trackingId, const std::string& name);
+
+	// 0 when the slot or tracking id is not tracked
+	UINT32 getPersonId(int slot) const;
+	UINT32 findPersonId(UINT64 trackingId) const;
+	void getPersonIds(UINT32* personIds) const;
+	bool getPerson(UINT32 id, KinectPerson& person) const;
+	int getPersonCount() const;
+
+private:
+	// folds the newer person id into the returning one and removes it
+	void merge(UINT32 returning, UINT32 id);
+	void forget(INT64 time);
+
+	std::unordered_map<UINT32, KinectPerson> persons;
+	std::unordered_map<UINT64, UINT32> trackedPersons; // tracking id to person id
+	UINT32 slotPersons[BODY_COUNT];
+	UINT32 nextId;
+	INT64 retention; // 100ns units
+	INT64 forgetTime;
+	INT64 lastTime;
+	float matchDistance;
+	mutable ofMutex mutex;
+};
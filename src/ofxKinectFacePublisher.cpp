@@ -0,0 +1,558 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFacePublisher.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+static const char PACKET_MAGIC[4] = { 'O', 'K', 'F', 'P' };
+static const char SHARED_MAGIC[4] = { 'O', 'K', 'F', 'S' };
+static const char OSC_ADDRESS[] = "/kinect/face\0\0\0\0,b\0\0"; // padded address and type tags
+
+static void append(std::vector<char>& out, const void* data, size_t size)
+{
+	out.insert(out.end(), (const char*)data, (const char*)data + size);
+}
+
+KinectFacePublisher::KinectFacePublisher()
+	: udpSocket(INVALID_SOCKET)
+	, addressSize(0)
+	, isOsc(false)
+	, isWsaStarted(false)
+	, sharedSlotCount(0)
+	, sharedMapping(NULL)
+	, sharedData(NULL)
+	, sharedSlotSize(0)
+	, lastSequence(0)
+{
+	memset(&address, 0, sizeof(address));
+	memset(&header, 0, sizeof(header));
+}
+
+KinectFacePublisher::~KinectFacePublisher()
+{
+	close();
+}
+
+// host may be a name or a numeric address
+bool KinectFacePublisher::setup(const std::string& host, int port, bool isOsc)
+{
+	this->isOsc = isOsc;
+
+	if (!isWsaStarted)
+	{
+		WSADATA wsaData;
+		isWsaStarted = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+		if (!isWsaStarted)
+		{
+			ofLogError("KinectFacePublisher") << "WSAStartup failed";
+			return false;
+		}
+	}
+
+	addrinfo hints = {0};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	addrinfo* result = NULL;
+	if (getaddrinfo(host.c_str(), ofToString(port).c_str(), &hints, &result) != 0 || !result)
+	{
+		ofLogError("KinectFacePublisher") << "can't resolve " << host;
+		return false;
+	}
+
+	if (udpSocket != INVALID_SOCKET)
+	{
+		closesocket(udpSocket);
+	}
+	udpSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	memcpy(&address, result->ai_addr, result->ai_addrlen);
+	addressSize = (int)result->ai_addrlen;
+	freeaddrinfo(result);
+
+	if (udpSocket == INVALID_SOCKET)
+	{
+		ofLogError("KinectFacePublisher") << "can't open udp socket";
+		return false;
+	}
+	return true;
+}
+
+// the ring is created on the first publish, once the frame size is known
+bool KinectFacePublisher::setupSharedMemory(const std::string& name, int slotCount)
+{
+	sharedName = name;
+	sharedSlotCount = slotCount > 0 ? slotCount : 1;
+	return true;
+}
+
+// every face sends a key frame at least this often so lost datagrams recover
+void KinectFacePublisher::setKeyFrameInterval(int frames)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		encoders[i].setKeyFrameInterval(frames);
+	}
+}
+
+void KinectFacePublisher::close()
+{
+	if (udpSocket != INVALID_SOCKET)
+	{
+		closesocket(udpSocket);
+		udpSocket = INVALID_SOCKET;
+	}
+	if (isWsaStarted)
+	{
+		WSACleanup();
+		isWsaStarted = false;
+	}
+	if (sharedData)
+	{
+		UnmapViewOfFile(sharedData);
+		sharedData = NULL;
+	}
+	if (sharedMapping)
+	{
+		CloseHandle(sharedMapping);
+		sharedMapping = NULL;
+	}
+	sharedName.clear();
+}
+
+void KinectFacePublisher::publish(ofxKinectFace& face)
+{
+	if (face.getFrameSequence() == lastSequence)return;
+	beginFrame(face, KINECT_SOURCE_FACE);
+
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		if(!face.getIsFaceTracked(i))continue;
+
+		KinectFacePacket packet;
+		ofQuaternion q = face.getRotation(i);
+		packet.rotation.x = q.x();
+		packet.rotation.y = q.y();
+		packet.rotation.z = q.z();
+		packet.rotation.w = q.w();
+		ofRectangle rect = face.getFaceRect(i);
+		packet.rect[0] = rect.x;
+		packet.rect[1] = rect.y;
+		packet.rect[2] = rect.width;
+		packet.rect[3] = rect.height;
+		for (int j = 0; j < FacePointType::FacePointType_Count; j++)
+		{
+			ofPoint p = face.getFacePoint(i, (FacePointType)j);
+			packet.points[j].X = p.x;
+			packet.points[j].Y = p.y;
+		}
+		for (int j = 0; j < FaceProperty::FaceProperty_Count; j++)
+		{
+			packet.properties[j] = (UINT8)face.getFaceProperty(i, (FaceProperty)j);
+		}
+
+		writeFace(i, &packet, sizeof(packet), NULL, 0, datagram);
+		send(datagram);
+		if (sharedName.size())
+		{
+			writeFace(i, &packet, sizeof(packet), NULL, 0, sharedFrame);
+		}
+	}
+
+	endFrame(0);
+}
+
+void KinectFacePublisher::publish(ofxKinectHDFace& face)
+{
+	if (face.getFrameSequence() == lastSequence)return;
+	beginFrame(face, KINECT_SOURCE_HD_FACE);
+
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		if (!face.getIsFaceTracked(i))
+		{
+			// a new person in the slot starts with a key frame
+			encoders[i].reset();
+			continue;
+		}
+
+		const std::vector<CameraSpacePoint>& vertices = face.getCameraVertices(i);
+
+		KinectHDFacePacket packet = {0};
+		ofQuaternion q = face.getRotation(i);
+		packet.rotation.x = q.x();
+		packet.rotation.y = q.y();
+		packet.rotation.z = q.z();
+		packet.rotation.w = q.w();
+		ofPoint pivot = face.getHeadPivot3D(i);
+		packet.headPivot.X = pivot.x;
+		packet.headPivot.Y = pivot.y;
+		packet.headPivot.Z = pivot.z;
+		for (int j = 0; j < FaceShapeAnimations_Count; j++)
+		{
+			packet.animationUnits[j] = face.getFaceShapeAnimation(i, (FaceShapeAnimations)j);
+		}
+		packet.vertexCount = (UINT16)vertices.size();
+
+		encoded.clear();
+		if (!vertices.empty())
+		{
+			encoders[i].encode(packet.headPivot, vertices.data(), vertices.size(), encoded);
+		}
+		packet.vertexEncoding = encoded.empty() ? KINECT_VERTEX_NONE : KINECT_VERTEX_CODED;
+		writeFace(i, &packet, sizeof(packet), encoded.data(), encoded.size(), datagram);
+		send(datagram);
+
+		// same host readers may skip frames, so the ring always carries raw vertices
+		if (sharedName.size())
+		{
+			packet.vertexEncoding = vertices.empty() ? KINECT_VERTEX_NONE : KINECT_VERTEX_RAW;
+			writeFace(i, &packet, sizeof(packet), vertices.data(), vertices.size() * sizeof(CameraSpacePoint), sharedFrame);
+		}
+	}
+
+	endFrame(face.getVertexCount());
+}
+
+void KinectFacePublisher::beginFrame(KinectBase& face, KinectSourceMode mode)
+{
+	lastSequence = face.getFrameSequence();
+
+	memcpy(header.magic, PACKET_MAGIC, sizeof(header.magic));
+	header.version = KINECT_PACKET_VERSION;
+	header.mode = (UINT16)mode;
+	header.sequence = lastSequence;
+	header.time = face.getFrameTime();
+	header.trackedMask = header.validMask = 0;
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		if (face.getIsFaceTracked(i))header.trackedMask |= 1 << i;
+		if (face.getIsFaceValid(i))header.validMask |= 1 << i;
+	}
+	sharedFrame.clear();
+}
+
+// replaces out with one datagram, or appends a length prefixed one to the shared frame
+void KinectFacePublisher::writeFace(int slot, const void* packet, UINT32 packetSize, const void* vertices, UINT32 vertexBytes, std::vector<char>& out)
+{
+	bool isShared = &out == &sharedFrame;
+	if (!isShared)
+	{
+		out.clear();
+	}
+
+	header.slot = (UINT8)slot;
+	UINT32 size = sizeof(header) + packetSize + vertexBytes;
+	if (isShared)
+	{
+		append(out, &size, sizeof(size));
+	}
+	append(out, &header, sizeof(header));
+	append(out, packet, packetSize);
+	append(out, vertices, vertexBytes);
+}
+
+// sends a datagram, wrapped into an osc message with a single blob argument if requested
+void KinectFacePublisher::send(const std::vector<char>& data)
+{
+	if (udpSocket == INVALID_SOCKET || data.empty())return;
+
+	const char* payload = data.data();
+	int size = data.size();
+	if (isOsc)
+	{
+		UINT32 blobSize = htonl(size);
+		oscMessage.clear();
+		append(oscMessage, OSC_ADDRESS, sizeof(OSC_ADDRESS) - 1);
+		append(oscMessage, &blobSize, sizeof(blobSize));
+		append(oscMessage, payload, size);
+		oscMessage.resize((oscMessage.size() + 3) & ~3, 0);
+		payload = oscMessage.data();
+		size = oscMessage.size();
+	}
+
+	sendto(udpSocket, payload, size, 0, (const sockaddr*)&address, addressSize);
+}
+
+// vertexCount sizes the shared ring slots when they are created
+void KinectFacePublisher::endFrame(UINT32 vertexCount)
+{
+	// frames without faces still tell receivers that everyone left
+	if (header.trackedMask == 0)
+	{
+		writeFace(KINECT_PACKET_NO_FACE, NULL, 0, NULL, 0, datagram);
+		send(datagram);
+		if (sharedName.size())
+		{
+			writeFace(KINECT_PACKET_NO_FACE, NULL, 0, NULL, 0, sharedFrame);
+		}
+	}
+
+	if (sharedName.empty())return;
+
+	if (!sharedData && !openSharedMemory(sizeof(KinectSharedSlot) + BODY_COUNT * (sizeof(UINT32) + sizeof(KinectPacketHeader)
+		+ MAX(sizeof(KinectFacePacket), sizeof(KinectHDFacePacket)) + vertexCount * sizeof(CameraSpacePoint))))
+	{
+		sharedName.clear();
+		return;
+	}
+	if (sizeof(KinectSharedSlot) + sharedFrame.size() > sharedSlotSize)return;
+
+	// readers check the stamp before and after copying a slot
+	KinectSharedRingHeader* ring = (KinectSharedRingHeader*)sharedData;
+	LONG64 frame = ring->writeCount + 1;
+	KinectSharedSlot* slot = (KinectSharedSlot*)(sharedData + sizeof(KinectSharedRingHeader) + ((frame - 1) % sharedSlotCount) * sharedSlotSize);
+	InterlockedExchange64(&slot->stamp, 0);
+	slot->size = sharedFrame.size();
+	memcpy(slot + 1, sharedFrame.data(), sharedFrame.size());
+	InterlockedExchange64(&slot->stamp, frame);
+	InterlockedExchange64(&ring->writeCount, frame);
+}
+
+bool KinectFacePublisher::openSharedMemory(UINT32 slotSize)
+{
+	sharedSlotSize = (slotSize + 63) & ~63;
+	DWORD size = sizeof(KinectSharedRingHeader) + sharedSlotSize * sharedSlotCount;
+	sharedMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, sharedName.c_str());
+	if (sharedMapping)
+	{
+		sharedData = (BYTE*)MapViewOfFile(sharedMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	}
+	if (!sharedData)
+	{
+		ofLogError("KinectFacePublisher") << "can't create shared memory " << sharedName;
+		return false;
+	}
+
+	memset(sharedData, 0, size);
+	KinectSharedRingHeader* ring = (KinectSharedRingHeader*)sharedData;
+	memcpy(ring->magic, SHARED_MAGIC, sizeof(ring->magic));
+	ring->slotSize = sharedSlotSize;
+	ring->slotCount = sharedSlotCount;
+	return true;
+}
+
+#pragma mark - KinectFaceReceiver
+
+// the largest datagram the publisher sends: raw vertices of the full model wrapped into osc
+static const int RECEIVE_BUFFER_SIZE = 65536;
+
+KinectFaceReceiver::KinectFaceReceiver()
+	: udpSocket(INVALID_SOCKET)
+	, isOsc(false)
+	, isWsaStarted(false)
+	, sharedMapping(NULL)
+	, sharedData(NULL)
+	, sharedFrameCount(0)
+{
+}
+
+KinectFaceReceiver::~KinectFaceReceiver()
+{
+	close();
+}
+
+bool KinectFaceReceiver::setup(int port, bool isOsc)
+{
+	this->isOsc = isOsc;
+
+	if (!isWsaStarted)
+	{
+		WSADATA wsaData;
+		isWsaStarted = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+		if (!isWsaStarted)
+		{
+			ofLogError("KinectFaceReceiver") << "WSAStartup failed";
+			return false;
+		}
+	}
+
+	if (udpSocket != INVALID_SOCKET)
+	{
+		closesocket(udpSocket);
+	}
+	udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (udpSocket == INVALID_SOCKET)
+	{
+		ofLogError("KinectFaceReceiver") << "can't open udp socket";
+		return false;
+	}
+
+	sockaddr_in local = {0};
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port = htons((u_short)port);
+	u_long isNonBlocking = 1;
+	if (bind(udpSocket, (const sockaddr*)&local, sizeof(local)) != 0 || ioctlsocket(udpSocket, FIONBIO, &isNonBlocking) != 0)
+	{
+		ofLogError("KinectFaceReceiver") << "can't bind udp port " << port;
+		closesocket(udpSocket);
+		udpSocket = INVALID_SOCKET;
+		return false;
+	}
+	buffer.resize(RECEIVE_BUFFER_SIZE);
+	return true;
+}
+
+// the ring is opened on the first receiveShared(), once the publisher created it
+bool KinectFaceReceiver::setupSharedMemory(const std::string& name)
+{
+	sharedName = name;
+	sharedFrameCount = 0;
+	return true;
+}
+
+void KinectFaceReceiver::close()
+{
+	if (udpSocket != INVALID_SOCKET)
+	{
+		closesocket(udpSocket);
+		udpSocket = INVALID_SOCKET;
+	}
+	if (isWsaStarted)
+	{
+		WSACleanup();
+		isWsaStarted = false;
+	}
+	if (sharedData)
+	{
+		UnmapViewOfFile(sharedData);
+		sharedData = NULL;
+	}
+	if (sharedMapping)
+	{
+		CloseHandle(sharedMapping);
+		sharedMapping = NULL;
+	}
+	sharedName.clear();
+}
+
+bool KinectFaceReceiver::receive(KinectReceivedFace& face)
+{
+	if (udpSocket == INVALID_SOCKET)return false;
+
+	// malformed datagrams are dropped
+	int size = 0;
+	while ((size = recv(udpSocket, buffer.data(), buffer.size(), 0)) > 0)
+	{
+		const char* data = buffer.data();
+		if (isOsc)
+		{
+			// the address and type tags the publisher writes, then the blob size
+			const int prefix = sizeof(OSC_ADDRESS) - 1;
+			if (size < prefix + (int)sizeof(UINT32) || memcmp(data, OSC_ADDRESS, prefix) != 0)continue;
+
+			UINT32 blobSize = ntohl(*(const UINT32*)(data + prefix));
+			data += prefix + sizeof(UINT32);
+			size -= prefix + sizeof(UINT32);
+			if (blobSize > (UINT32)size)continue;
+			size = blobSize;
+		}
+		if (decode(data, size, face))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool KinectFaceReceiver::receiveShared(std::vector<KinectReceivedFace>& faces)
+{
+	if (sharedName.empty())return false;
+
+	if (!sharedData)
+	{
+		sharedMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, sharedName.c_str());
+		if (!sharedMapping)return false;
+
+		sharedData = (const BYTE*)MapViewOfFile(sharedMapping, FILE_MAP_READ, 0, 0, 0);
+		if (!sharedData || memcmp(((const KinectSharedRingHeader*)sharedData)->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC)) != 0)
+		{
+			if (sharedData)UnmapViewOfFile(sharedData);
+			sharedData = NULL;
+			CloseHandle(sharedMapping);
+			sharedMapping = NULL;
+			return false;
+		}
+	}
+
+	const KinectSharedRingHeader* ring = (const KinectSharedRingHeader*)sharedData;
+	LONG64 frame = ring->writeCount;
+	if (frame == 0 || frame == sharedFrameCount)return false;
+
+	const KinectSharedSlot* slot = (const KinectSharedSlot*)(sharedData + sizeof(KinectSharedRingHeader) + ((frame - 1) % ring->slotCount) * ring->slotSize);
+	if (slot->stamp != frame || slot->size > ring->slotSize - sizeof(KinectSharedSlot))return false;
+
+	// copied first, the stamp tells whether the publisher overwrote the slot meanwhile
+	sharedBuffer.assign((const char*)(slot + 1), (const char*)(slot + 1) + slot->size);
+	if (slot->stamp != frame)return false;
+	sharedFrameCount = frame;
+
+	faces.clear();
+	UINT32 offset = 0;
+	while (offset + sizeof(UINT32) <= sharedBuffer.size())
+	{
+		UINT32 size = *(const UINT32*)(sharedBuffer.data() + offset);
+		offset += sizeof(UINT32);
+		if (offset + size > sharedBuffer.size())break;
+
+		faces.push_back(KinectReceivedFace());
+		if (!decode(sharedBuffer.data() + offset, size, faces.back()))
+		{
+			faces.pop_back();
+		}
+		offset += size;
+	}
+	return true;
+}
+
+bool KinectFaceReceiver::decode(const char* data, UINT32 size, KinectReceivedFace& face)
+{
+	face.vertices.clear();
+	if (size < sizeof(KinectPacketHeader))return false;
+
+	memcpy(&face.header, data, sizeof(KinectPacketHeader));
+	if (memcmp(face.header.magic, PACKET_MAGIC, sizeof(PACKET_MAGIC)) != 0 || face.header.version != KINECT_PACKET_VERSION)return false;
+
+	data += sizeof(KinectPacketHeader);
+	size -= sizeof(KinectPacketHeader);
+	if (face.header.slot == KINECT_PACKET_NO_FACE)return true;
+	if (face.header.slot >= BODY_COUNT)return false;
+
+	if (face.header.mode == KINECT_SOURCE_FACE)
+	{
+		if (size < sizeof(KinectFacePacket))return false;
+		memcpy(&face.face, data, sizeof(KinectFacePacket));
+		return true;
+	}
+
+	if (size < sizeof(KinectHDFacePacket))return false;
+	memcpy(&face.hdFace, data, sizeof(KinectHDFacePacket));
+	data += sizeof(KinectHDFacePacket);
+	size -= sizeof(KinectHDFacePacket);
+
+	const UINT32 count = face.hdFace.vertexCount;
+	switch (face.hdFace.vertexEncoding)
+	{
+	case KINECT_VERTEX_RAW:
+		if (size < count * sizeof(CameraSpacePoint))return false;
+		face.vertices.resize(count);
+		memcpy(face.vertices.data(), data, count * sizeof(CameraSpacePoint));
+		break;
+	case KINECT_VERTEX_CODED:
+		face.vertices.resize(count);
+		if (!decoders[face.header.slot].decode((const BYTE*)data, size, face.vertices.data(), count))
+		{
+			face.vertices.clear();
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
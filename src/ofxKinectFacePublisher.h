@@ -0,0 +1,167 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofxKinectFace.h"
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+// wire format, little endian. every datagram is a KinectPacketHeader followed by
+// one KinectFacePacket or KinectHDFacePacket (+ vertices), slot 0xff carries no face.
+static const UINT16 KINECT_PACKET_VERSION = 2;
+static const UINT8 KINECT_PACKET_NO_FACE = 0xff;
+
+enum KinectVertexEncoding
+{
+	KINECT_VERTEX_NONE,
+	KINECT_VERTEX_RAW,   // CameraSpacePoint per vertex
+	KINECT_VERTEX_CODED, // one KinectVertexBlock, see KinectVertexDecoder
+};
+
+#pragma pack(push, 1)
+struct KinectPacketHeader
+{
+	char magic[4]; // "OKFP"
+	UINT16 version;
+	UINT16 mode;   // KinectSourceMode
+	UINT64 sequence;
+	INT64 time;
+	UINT8 trackedMask;
+	UINT8 validMask;
+	UINT8 slot;
+	UINT8 reserved;
+};
+
+struct KinectFacePacket
+{
+	Vector4 rotation;
+	float rect[4];
+	PointF points[FacePointType::FacePointType_Count];
+	UINT8 properties[FaceProperty::FaceProperty_Count];
+};
+
+struct KinectHDFacePacket
+{
+	Vector4 rotation;
+	CameraSpacePoint headPivot;
+	float animationUnits[FaceShapeAnimations_Count];
+	UINT8 vertexEncoding;
+	UINT8 reserved;
+	UINT16 vertexCount;
+};
+
+// shared memory ring: KinectSharedRingHeader, then slotCount slots of slotSize bytes,
+// each a KinectSharedSlot followed by UINT32 length prefixed datagrams with raw vertices
+struct KinectSharedRingHeader
+{
+	char magic[4]; // "OKFS"
+	UINT32 slotSize;
+	UINT32 slotCount;
+	UINT32 reserved;
+	volatile LONG64 writeCount; // frames written so far, the newest is in slot (writeCount - 1) % slotCount
+};
+
+struct KinectSharedSlot
+{
+	volatile LONG64 stamp; // frame number, 0 while the slot is written
+	UINT32 size;
+	UINT32 reserved;
+};
+#pragma pack(pop)
+
+#pragma mark - KinectFacePublisher
+
+// streams processed face frames over udp (optionally as osc blobs) and/or a shared memory ring
+class KinectFacePublisher
+{
+public:
+	KinectFacePublisher();
+	~KinectFacePublisher();
+
+	bool setup(const std::string& host, int port, bool isOsc = false);
+	bool setupSharedMemory(const std::string& name, int slotCount = 8);
+	void setKeyFrameInterval(int frames);
+	void close();
+
+	// call after update(), only sends when a new face frame was processed
+	void publish(ofxKinectFace& face);
+	void publish(ofxKinectHDFace& face);
+
+private:
+	void beginFrame(KinectBase& face, KinectSourceMode mode);
+	void writeFace(int slot, const void* packet, UINT32 packetSize, const void* vertices, UINT32 vertexBytes, std::vector<char>& out);
+	void send(const std::vector<char>& data);
+	void endFrame(UINT32 vertexCount);
+	bool openSharedMemory(UINT32 slotSize);
+
+	SOCKET udpSocket;
+	sockaddr_storage address;
+	int addressSize;
+	bool isOsc;
+	bool isWsaStarted;
+
+	std::string sharedName;
+	int sharedSlotCount;
+	HANDLE sharedMapping;
+	BYTE* sharedData;
+	UINT32 sharedSlotSize;
+
+	KinectPacketHeader header;
+	UINT64 lastSequence;
+	KinectVertexEncoder encoders[BODY_COUNT];
+	std::vector<BYTE> encoded;
+	std::vector<char> datagram;
+	std::vector<char> oscMessage;
+	std::vector<char> sharedFrame;
+};
+
+#pragma mark - KinectFaceReceiver
+
+// one face as sent by KinectFacePublisher, only the packet of header.mode is filled
+struct KinectReceivedFace
+{
+	KinectPacketHeader header;
+	KinectFacePacket face;
+	KinectHDFacePacket hdFace;
+	std::vector<CameraSpacePoint> vertices; // empty when none were sent or a delta's base was lost
+};
+
+// decodes the publisher's datagrams and shared memory ring, a minimal reference for receivers
+class KinectFaceReceiver
+{
+public:
+	KinectFaceReceiver();
+	~KinectFaceReceiver();
+
+	// binds a non-blocking udp socket on the local port
+	bool setup(int port, bool isOsc = false);
+	bool setupSharedMemory(const std::string& name);
+	void close();
+
+	// the next waiting datagram, false when there is none
+	bool receive(KinectReceivedFace& face);
+	// the faces of the newest ring frame, false when no new frame was written since the last call
+	bool receiveShared(std::vector<KinectReceivedFace>& faces);
+	// one datagram without osc wrapping
+	bool decode(const char* data, UINT32 size, KinectReceivedFace& face);
+
+private:
+	SOCKET udpSocket;
+	bool isOsc;
+	bool isWsaStarted;
+
+	std::string sharedName;
+	HANDLE sharedMapping;
+	const BYTE* sharedData;
+	LONG64 sharedFrameCount;
+
+	KinectVertexDecoder decoders[BODY_COUNT];
+	std::vector<char> buffer;
+	std::vector<char> sharedBuffer;
+};
@@ -0,0 +1,119 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceQuality.h"
+
+// about half a second to react at 30 fps, three seconds to recover
+static const int RAISE_FRAMES = 15;
+static const int LOWER_FRAMES = 90;
+static const double LOWER_RATIO = 0.7;
+static const double COST_SMOOTHING = 0.1;
+
+KinectQualitySettings::KinectQualitySettings()
+	: isEnabled(false)
+	, budget(25000.f)
+	, maxLevel(KINECT_QUALITY_ROUND_ROBIN)
+	, farDistance(2.5f)
+	, stableDistance(0.005f)
+	, stableAngle(2.f)
+{
+}
+
+#pragma mark - KinectQualityScheduler
+
+KinectQualityScheduler::KinectQualityScheduler()
+	: level(KINECT_QUALITY_FULL)
+	, averageCost(0.0)
+	, frame(0)
+	, framesAtLevel(0)
+{
+}
+
+void KinectQualityScheduler::setSettings(const KinectQualitySettings& settings)
+{
+	ofScopedLock lock(mutex);
+	this->settings = settings;
+}
+
+KinectQualitySettings KinectQualityScheduler::getSettings()
+{
+	ofScopedLock lock(mutex);
+	return settings;
+}
+
+void KinectQualityScheduler::reset()
+{
+	level = KINECT_QUALITY_FULL;
+	averageCost = 0.0;
+	frame = 0;
+	framesAtLevel = 0;
+}
+
+bool KinectQualityScheduler::isColorSkipped() const
+{
+	return getLevel() >= KINECT_QUALITY_HALF_COLOR && (frame & 1);
+}
+
+bool KinectQualityScheduler::isSlotScheduled(int activeIndex, int activeCount) const
+{
+	return getLevel() < KINECT_QUALITY_ROUND_ROBIN || activeCount <= 1 || (activeIndex + frame) % 2 == 0;
+}
+
+// faces alternate so that every other frame updates half of them
+bool KinectQualityScheduler::isVertexScheduled(int slot, float distance, bool isStable) const
+{
+	if (getLevel() < KINECT_QUALITY_THROTTLED_VERTICES)return true;
+	if (distance <= current.farDistance && !isStable)return true;
+	return (slot + frame) % 2 == 0;
+}
+
+bool KinectQualityScheduler::isStable(const ofVec3f& pivot, const ofQuaternion& rotation, const ofVec3f& lastPivot, const ofQuaternion& lastRotation) const
+{
+	if (pivot.squareDistance(lastPivot) > current.stableDistance * current.stableDistance)return false;
+
+	float dot = fabsf(rotation.asVec4().dot(lastRotation.asVec4()));
+	return 2.f * acosf(MIN(dot, 1.f)) * RAD_TO_DEG <= current.stableAngle;
+}
+
+void KinectQualityScheduler::endFrame(UINT64 micros)
+{
+	{
+		ofScopedLock lock(mutex);
+		current = settings;
+	}
+	frame++;
+
+	double cost = averageCost.load();
+	cost = cost > 0.0 ? cost + COST_SMOOTHING * (micros - cost) : micros;
+	averageCost = cost;
+
+	int next = level.load();
+	if (!current.isEnabled)
+	{
+		next = KINECT_QUALITY_FULL;
+	}
+	else if (cost > current.budget && framesAtLevel >= RAISE_FRAMES)
+	{
+		next = MIN(next + 1, (int)ofClamp(current.maxLevel, KINECT_QUALITY_FULL, KINECT_QUALITY_ROUND_ROBIN));
+	}
+	else if (cost < current.budget * LOWER_RATIO && framesAtLevel >= LOWER_FRAMES)
+	{
+		next = MAX(next - 1, (int)KINECT_QUALITY_FULL);
+	}
+
+	if (next != level.load())
+	{
+		ofLogVerbose("KinectQualityScheduler") << "level " << level.load() << " -> " << next << " at " << (int)cost << " us per frame";
+		level = next;
+		framesAtLevel = 0;
+	}
+	else
+	{
+		framesAtLevel++;
+	}
+}
@@ -0,0 +1,69 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+
+// work reductions in the order they are applied, each level includes the ones before it
+enum KinectQualityLevel
+{
+	KINECT_QUALITY_FULL,
+	KINECT_QUALITY_THROTTLED_VERTICES, // far or stable hd faces update their vertices every other frame
+	KINECT_QUALITY_HALF_COLOR,         // color pixels are skipped on every other frame
+	KINECT_QUALITY_ROUND_ROBIN,        // half of the tracked slots are processed per frame
+	KINECT_QUALITY_LEVEL_COUNT,
+};
+
+struct KinectQualitySettings
+{
+	bool isEnabled;       // off keeps KINECT_QUALITY_FULL
+	float budget;         // worker microseconds per frame
+	int maxLevel;         // KinectQualityLevel
+	float farDistance;    // meters, faces further away count as far
+	float stableDistance; // meters of head motion since the last vertex update that still count as stable
+	float stableAngle;    // degrees of head rotation, likewise
+
+	KinectQualitySettings();
+};
+
+#pragma mark - KinectQualityScheduler
+
+// raises the level while the average frame cost stays over budget and lowers it
+// once the cost has been well below budget for a while
+class KinectQualityScheduler
+{
+public:
+	KinectQualityScheduler();
+
+	void setSettings(const KinectQualitySettings& settings);
+	KinectQualitySettings getSettings();
+	KinectQualityLevel getLevel() const { return (KinectQualityLevel)level.load(); }
+	// moving average of the worker's frame cost in microseconds
+	double getAverageCost() const { return averageCost.load(); }
+	void reset();
+
+	// worker side, decisions for the frame being processed
+	bool isColorSkipped() const;
+	// activeIndex is the slot's position among activeCount tracked slots
+	bool isSlotScheduled(int activeIndex, int activeCount) const;
+	bool isVertexScheduled(int slot, float distance, bool isStable) const;
+	bool isStable(const ofVec3f& pivot, const ofQuaternion& rotation, const ofVec3f& lastPivot, const ofQuaternion& lastRotation) const;
+	// worker side, the cost of the finished frame
+	void endFrame(UINT64 micros);
+
+private:
+	KinectQualitySettings settings; // guarded by mutex, copied to current by endFrame()
+	KinectQualitySettings current;
+	ofMutex mutex;
+	std::atomic<int> level;
+	std::atomic<double> averageCost;
+	UINT64 frame;
+	int framesAtLevel;
+};
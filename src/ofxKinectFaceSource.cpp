@@ -0,0 +1,2006 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceSource.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const int COLOR_WIDTH = 1920;
+static const int COLOR_HEIGHT = 1080;
+
+// face model cache files: ModelHeader, then FaceShapeDeformations_Count floats
+static const char MODEL_MAGIC[4] = { 'O', 'K', 'F', 'M' };
+static const UINT32 MODEL_VERSION = 1;
+
+// recording file layout: RecordHeader, then ChunkHeader + payload repeated.
+// every CHUNK_FRAME starts a new frame, body and face chunks belong to the frame before them.
+// replay reads every version up to RECORD_VERSION, chunks a version did not write are absent data.
+// version 1: FrameRecordV1 with rgba pixels, HDFaceRecordV1 with raw vertices
+// version 2: FrameRecord with yuy2 or rgba pixels
+// version 3: HDFaceRecord with coded vertices
+static const char RECORD_MAGIC[4] = { 'O', 'K', 'F', 'R' };
+static const UINT32 RECORD_VERSION = 3;
+
+enum RecordChunkType
+{
+	CHUNK_TOPOLOGY = 1,
+	CHUNK_PROJECTION,
+	CHUNK_FRAME,
+	CHUNK_FACES,
+	CHUNK_HD_FACES,
+	CHUNK_BODIES,
+	CHUNK_FACE_MODEL, // once per body whose hd face model was fitted
+	CHUNK_FACE_FEATURES, // FaceFrameFeatures of a face mode recording
+};
+
+struct RecordHeader
+{
+	char magic[4];
+	UINT32 version;
+	UINT32 mode;
+	UINT32 frames;
+};
+
+struct ChunkHeader
+{
+	UINT32 type;
+	UINT32 size;
+	INT64 time;
+};
+
+struct FrameRecord
+{
+	UINT32 width;
+	UINT32 height;
+	UINT32 channels; // 2 for yuy2, 4 for rgba
+	UINT32 reserved;
+};
+
+struct FrameRecordV1
+{
+	UINT32 width;
+	UINT32 height;
+};
+
+// followed by vertexBytes of vertices coded as a KinectVertexBlock
+struct HDFaceRecord
+{
+	UINT32 isUpdated;
+	UINT32 vertexCount;
+	UINT32 vertexBytes;
+	UINT32 reserved;
+	UINT64 trackingId;
+	CameraSpacePoint headPivot;
+	Vector4 orientation;
+	float animationUnits[FaceShapeAnimations_Count];
+};
+
+// versions 1 and 2, followed by vertexCount raw vertices
+struct HDFaceRecordV1
+{
+	UINT32 isUpdated;
+	UINT32 vertexCount;
+	UINT64 trackingId;
+	CameraSpacePoint headPivot;
+	Vector4 orientation;
+	float animationUnits[FaceShapeAnimations_Count];
+};
+
+struct FaceModelRecord
+{
+	UINT32 slot;
+	UINT32 reserved;
+	UINT64 trackingId;
+	KinectFaceModel model;
+};
+
+struct ModelHeader
+{
+	char magic[4];
+	UINT32 version;
+	UINT32 count;
+	float scale;
+};
+
+#pragma mark - KinectFaceModel
+
+KinectFaceModel::KinectFaceModel()
+	: scale(1.f)
+{
+	for (int i = 0; i < FaceShapeDeformations_Count; i++)
+	{
+		deformations[i] = 0.f;
+	}
+}
+
+bool KinectFaceModel::save(const std::string& path) const
+{
+	FILE* file = fopen(ofToDataPath(path).c_str(), "wb");
+	if (!file)
+	{
+		ofLogError("KinectFaceModel") << "could not open " << path;
+		return false;
+	}
+
+	ModelHeader header;
+	memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+	header.version = MODEL_VERSION;
+	header.count = FaceShapeDeformations_Count;
+	header.scale = scale;
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(deformations, sizeof(deformations), 1, file) == 1;
+	fclose(file);
+	return isWritten;
+}
+
+bool KinectFaceModel::load(const std::string& path)
+{
+	FILE* file = fopen(ofToDataPath(path).c_str(), "rb");
+	if (!file)return false;
+
+	ModelHeader header;
+	bool isRead = fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) == 0 && header.version == MODEL_VERSION
+		&& header.count == FaceShapeDeformations_Count
+		&& fread(deformations, sizeof(deformations), 1, file) == 1;
+	fclose(file);
+	if (isRead)
+	{
+		scale = header.scale;
+	}
+	return isRead;
+}
+
+#pragma mark - KinectColorProjection
+
+// solves a 3x3 linear system with cramer's rule
+static bool solve3(const double a[3][3], const double b[3], double x[3])
+{
+	double det =
+		a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+		- a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+		+ a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+	if (fabs(det) < 1e-12)return false;
+
+	for (int k = 0; k < 3; k++)
+	{
+		double m[3][3];
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				m[r][c] = (c == k) ? b[r] : a[r][c];
+			}
+		}
+		x[k] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+			- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+			+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+	}
+	return true;
+}
+
+// defaults are the nominal kinect v2 color camera intrinsics
+KinectColorProjection::KinectColorProjection()
+	: fx(1081.37f), fy(1081.37f)
+	, cx(959.5f), cy(539.5f)
+	, tx(0.f), ty(0.f)
+{
+}
+
+// least squares fit of u = fx * (X + tx) / Z + cx and v = cy - fy * (Y + ty) / Z
+// against points mapped by the sensor's coordinate mapper
+bool KinectColorProjection::fit(ICoordinateMapper* mapper)
+{
+	if (!mapper)return false;
+
+	std::vector<CameraSpacePoint> samples;
+	for (float z = 0.75f; z <= 3.5f; z += 0.5f)
+	{
+		for (float y = -0.4f; y <= 0.4f; y += 0.2f)
+		{
+			for (float x = -0.6f; x <= 0.6f; x += 0.2f)
+			{
+				CameraSpacePoint p = { x * z, y * z, z };
+				samples.push_back(p);
+			}
+		}
+	}
+
+	std::vector<ColorSpacePoint> mapped(samples.size());
+	HRESULT hr = mapper->MapCameraPointsToColorSpace(samples.size(), &samples[0], mapped.size(), &mapped[0]);
+	if (FAILED(hr))return false;
+
+	double au[3][3] = {0}, bu[3] = {0};
+	double av[3][3] = {0}, bv[3] = {0};
+	int count = 0;
+	for (int i = 0; i < samples.size(); i++)
+	{
+		if (!_finite(mapped[i].X) || !_finite(mapped[i].Y))continue;
+
+		double ru[3] = { samples[i].X / samples[i].Z, 1.0 / samples[i].Z, 1.0 };
+		double rv[3] = { samples[i].Y / samples[i].Z, 1.0 / samples[i].Z, 1.0 };
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				au[r][c] += ru[r] * ru[c];
+				av[r][c] += rv[r] * rv[c];
+			}
+			bu[r] += ru[r] * mapped[i].X;
+			bv[r] += rv[r] * mapped[i].Y;
+		}
+		count++;
+	}
+
+	double su[3], sv[3];
+	if (count < 3 || !solve3(au, bu, su) || !solve3(av, bv, sv))return false;
+	if (su[0] == 0.0 || sv[0] == 0.0)return false;
+
+	fx = su[0];
+	tx = su[1] / su[0];
+	cx = su[2];
+	fy = -sv[0];
+	ty = sv[1] / sv[0];
+	cy = sv[2];
+	return true;
+}
+
+// four points per step with sse2, same operation order as the scalar tail so both agree bit for bit
+void KinectColorProjection::project(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count) const
+{
+	UINT i = 0;
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+	const __m128 vfx = _mm_set1_ps(fx);
+	const __m128 vfy = _mm_set1_ps(fy);
+	const __m128 vcx = _mm_set1_ps(cx);
+	const __m128 vcy = _mm_set1_ps(cy);
+	const __m128 vtx = _mm_set1_ps(tx);
+	const __m128 vty = _mm_set1_ps(ty);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 behind = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+
+	for (; i + 4 <= count; i += 4)
+	{
+		// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3 to one register per axis
+		const float* p = &src[i].X;
+		__m128 a = _mm_loadu_ps(p);
+		__m128 b = _mm_loadu_ps(p + 4);
+		__m128 c = _mm_loadu_ps(p + 8);
+		__m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+		__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+		__m128 invZ = _mm_div_ps(_mm_set1_ps(1.f), z);
+		__m128 u = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(vfx, _mm_add_ps(x, vtx)), invZ), vcx);
+		__m128 v = _mm_sub_ps(vcy, _mm_mul_ps(_mm_mul_ps(vfy, _mm_add_ps(y, vty)), invZ));
+
+		__m128 isBehind = _mm_cmple_ps(z, zero);
+		u = _mm_or_ps(_mm_and_ps(isBehind, behind), _mm_andnot_ps(isBehind, u));
+		v = _mm_or_ps(_mm_and_ps(isBehind, behind), _mm_andnot_ps(isBehind, v));
+
+		float* q = &dst[i].X;
+		_mm_storeu_ps(q, _mm_unpacklo_ps(u, v));
+		_mm_storeu_ps(q + 4, _mm_unpackhi_ps(u, v));
+	}
+#endif
+
+	projectScalar(src + i, dst + i, count - i);
+}
+
+void KinectColorProjection::projectScalar(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count) const
+{
+	for (UINT i = 0; i < count; i++)
+	{
+		if (src[i].Z <= 0.f)
+		{
+			dst[i].X = dst[i].Y = -std::numeric_limits<float>::infinity();
+			continue;
+		}
+		float invZ = 1.f / src[i].Z;
+		dst[i].X = fx * (src[i].X + tx) * invZ + cx;
+		dst[i].Y = cy - fy * (src[i].Y + ty) * invZ;
+	}
+}
+
+#pragma mark - KinectConvertYuy2ToRgba
+
+static inline BYTE clampByte(int value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// bt.601 with 6 bit fixed point coefficients, 8 pixels per sse2 iteration
+void KinectConvertYuy2ToRgba(const unsigned char* src, unsigned char* dst, int pixelCount)
+{
+	int i = 0;
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+	const __m128i lowMask = _mm_set1_epi16(0x00FF);
+	const __m128i pairMask = _mm_set1_epi32(0x0000FFFF);
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+	const __m128i kRV = _mm_set1_epi16(90);
+	const __m128i kGU = _mm_set1_epi16(22);
+	const __m128i kGV = _mm_set1_epi16(46);
+	const __m128i kBU = _mm_set1_epi16(113);
+
+	for (; i + 8 <= pixelCount; i += 8)
+	{
+		__m128i yuy2 = _mm_loadu_si128((const __m128i*)(src + i * 2));
+		__m128i y = _mm_and_si128(yuy2, lowMask);
+		__m128i uv = _mm_srli_epi16(yuy2, 8);
+
+		// spread each u and v over the two pixels that share it
+		__m128i u = _mm_and_si128(uv, pairMask);
+		u = _mm_sub_epi16(_mm_or_si128(u, _mm_slli_epi32(u, 16)), bias);
+		__m128i v = _mm_srli_epi32(uv, 16);
+		v = _mm_sub_epi16(_mm_or_si128(v, _mm_slli_epi32(v, 16)), bias);
+
+		__m128i r = _mm_add_epi16(y, _mm_srai_epi16(_mm_mullo_epi16(v, kRV), 6));
+		__m128i g = _mm_sub_epi16(y, _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(u, kGU), _mm_mullo_epi16(v, kGV)), 6));
+		__m128i b = _mm_add_epi16(y, _mm_srai_epi16(_mm_mullo_epi16(u, kBU), 6));
+
+		__m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+		__m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), alpha);
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+#endif
+
+	for (; i + 2 <= pixelCount; i += 2)
+	{
+		const unsigned char* p = src + i * 2;
+		int u = p[1] - 128;
+		int v = p[3] - 128;
+		int dr = (v * 90) >> 6;
+		int dg = (u * 22 + v * 46) >> 6;
+		int db = (u * 113) >> 6;
+		for (int k = 0; k < 2; k++)
+		{
+			int y = p[k * 2];
+			unsigned char* q = dst + (i + k) * 4;
+			q[0] = clampByte(y + dr);
+			q[1] = clampByte(y - dg);
+			q[2] = clampByte(y + db);
+			q[3] = 255;
+		}
+	}
+}
+
+#pragma mark - KinectValidateFace
+
+static inline bool isInside(float x, float y, int width, int height)
+{
+	return x > 0.f && x <= width && y > 0.f && y <= height;
+}
+
+static inline bool isZero(const Vector4& q)
+{
+	return q.x == 0.f && q.y == 0.f && q.z == 0.f && q.w == 0.f;
+}
+
+KinectFaceRejection KinectValidateFace(const KinectFaceData& face, int width, int height, DWORD features)
+{
+	if (features & FaceFrameFeatures::FaceFrameFeatures_BoundingBoxInColorSpace)
+	{
+		if (!isInside(face.boundingBox.Left, face.boundingBox.Top, width, height))return KINECT_FACE_RECT_OUTSIDE;
+	}
+	if (features & FaceFrameFeatures::FaceFrameFeatures_PointsInColorSpace)
+	{
+		for (int j = 0; j < FacePointType::FacePointType_Count; j++)
+		{
+			if (!isInside(face.points[j].X, face.points[j].Y, width, height))return KINECT_FACE_POINT_OUTSIDE;
+		}
+	}
+	if (features & FaceFrameFeatures::FaceFrameFeatures_RotationOrientation)
+	{
+		if (isZero(face.rotation))return KINECT_FACE_NO_ROTATION;
+	}
+	return KINECT_FACE_ACCEPTED;
+}
+
+// the pivot is projected with the pinhole fit rather than the sensor's mapper
+KinectFaceRejection KinectValidateHDFace(const KinectHDFaceData& face, const KinectColorProjection& projection, int width, int height)
+{
+	ColorSpacePoint pivot;
+	projection.project(&face.headPivot, &pivot, 1);
+	if (!isInside(pivot.X, pivot.Y, width, height))return KINECT_FACE_PIVOT_OUTSIDE;
+	if (isZero(face.orientation))return KINECT_FACE_NO_ROTATION;
+	return KINECT_FACE_ACCEPTED;
+}
+
+#pragma mark - KinectVertexCodec
+
+KinectVertexEncoder::KinectVertexEncoder(int keyFrameInterval, float step)
+	: keyFrameInterval(keyFrameInterval > 0 ? keyFrameInterval : 1)
+	, framesSinceKey(0)
+	, step(step)
+	, frame(0)
+{
+}
+
+void KinectVertexEncoder::setKeyFrameInterval(int frames)
+{
+	keyFrameInterval = frames > 0 ? frames : 1;
+}
+
+void KinectVertexEncoder::reset()
+{
+	reference.clear();
+}
+
+UINT32 KinectVertexEncoder::encode(const CameraSpacePoint& pivot, const CameraSpacePoint* vertices, UINT32 count, std::vector<BYTE>& out)
+{
+	KinectVertexBlock block = {0};
+	block.count = count;
+	block.frame = ++frame;
+	block.step = step;
+	block.pivot = pivot;
+
+	bool isQuantized = true;
+	quantized.resize(count * 3);
+	const float* src = &vertices[0].X;
+	const float* origin = &pivot.X;
+	for (UINT32 k = 0; k < count * 3 && isQuantized; k++)
+	{
+		float q = floorf((src[k] - origin[k % 3]) / step + 0.5f);
+		isQuantized = q >= -32768.f && q <= 32767.f;
+		quantized[k] = (INT16)q;
+	}
+
+	size_t start = out.size();
+	out.resize(start + sizeof(block));
+	if (!isQuantized)
+	{
+		block.type = KINECT_VERTEX_BLOCK_RAW;
+		const BYTE* p = (const BYTE*)vertices;
+		out.insert(out.end(), p, p + sizeof(CameraSpacePoint) * count);
+		reference.clear();
+	}
+	else if (reference.size() != quantized.size() || framesSinceKey + 1 >= keyFrameInterval)
+	{
+		block.type = KINECT_VERTEX_BLOCK_KEY;
+		const BYTE* p = (const BYTE*)quantized.data();
+		out.insert(out.end(), p, p + sizeof(INT16) * quantized.size());
+		reference.swap(quantized);
+		framesSinceKey = 0;
+	}
+	else
+	{
+		// consecutive offsets barely move, most differences fit in one byte
+		block.type = KINECT_VERTEX_BLOCK_DELTA;
+		block.baseFrame = frame - 1;
+		for (size_t k = 0; k < quantized.size(); k++)
+		{
+			int d = quantized[k] - reference[k];
+			UINT32 z = ((UINT32)d << 1) ^ (UINT32)(d >> 31);
+			while (z >= 0x80)
+			{
+				out.push_back((BYTE)(z | 0x80));
+				z >>= 7;
+			}
+			out.push_back((BYTE)z);
+		}
+		reference.swap(quantized);
+		framesSinceKey++;
+	}
+
+	block.payloadSize = out.size() - start - sizeof(block);
+	memcpy(&out[start], &block, sizeof(block));
+	return out.size() - start;
+}
+
+KinectVertexDecoder::KinectVertexDecoder()
+	: frame(0)
+{
+}
+
+bool KinectVertexDecoder::decode(const BYTE* data, UINT32 size, CameraSpacePoint* vertices, UINT32 count)
+{
+	if (size < sizeof(KinectVertexBlock))return false;
+
+	KinectVertexBlock block;
+	memcpy(&block, data, sizeof(block));
+	const BYTE* payload = data + sizeof(block);
+	const BYTE* end = payload + block.payloadSize;
+	if (block.count != count || block.payloadSize > size - sizeof(block))return false;
+
+	if (block.type == KINECT_VERTEX_BLOCK_RAW)
+	{
+		if (block.payloadSize != sizeof(CameraSpacePoint) * count)return false;
+		memcpy(vertices, payload, block.payloadSize);
+		reference.clear();
+		frame = block.frame;
+		return true;
+	}
+
+	if (block.type == KINECT_VERTEX_BLOCK_KEY)
+	{
+		if (block.payloadSize != sizeof(INT16) * count * 3)return false;
+		reference.resize(count * 3);
+		memcpy(reference.data(), payload, block.payloadSize);
+	}
+	else if (block.type == KINECT_VERTEX_BLOCK_DELTA)
+	{
+		if (reference.size() != count * 3 || block.baseFrame != frame)return false;
+		for (size_t k = 0; k < reference.size(); k++)
+		{
+			UINT32 z = 0;
+			for (int shift = 0; ; shift += 7)
+			{
+				if (payload >= end || shift > 28)return false;
+				BYTE b = *payload++;
+				z |= (UINT32)(b & 0x7F) << shift;
+				if (!(b & 0x80))break;
+			}
+			int d = (int)(z >> 1) ^ -(int)(z & 1);
+			reference[k] = (INT16)(reference[k] + d);
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	frame = block.frame;
+	float* dst = &vertices[0].X;
+	const float* origin = &block.pivot.X;
+	for (size_t k = 0; k < reference.size(); k++)
+	{
+		dst[k] = origin[k % 3] + reference[k] * block.step;
+	}
+	return true;
+}
+
+#pragma mark - KinectFrameSource
+
+// sources without arrival notifications are simply polled
+bool KinectFrameSource::waitForFrame(DWORD timeoutMillis)
+{
+	return true;
+}
+
+bool KinectFrameSource::isExhausted()
+{
+	return false;
+}
+
+bool KinectFrameSource::mapCameraToColor(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count)
+{
+	projection.project(src, dst, count);
+	return true;
+}
+
+KinectColorProjection KinectFrameSource::getColorProjection()
+{
+	return projection;
+}
+
+void KinectFrameSource::setStats(KinectStats* stats)
+{
+	this->stats = stats;
+}
+
+KinectFaceModelStatus KinectFrameSource::getFaceModelStatus(int idx)
+{
+	return KINECT_MODEL_GENERIC;
+}
+
+bool KinectFrameSource::getFaceModel(int idx, KinectFaceModel& model)
+{
+	return false;
+}
+
+bool KinectFrameSource::setFaceModel(int idx, const KinectFaceModel& model)
+{
+	return false;
+}
+
+void KinectFrameSource::setFaceFeatures(DWORD features)
+{
+	faceFeatures = features;
+}
+
+#pragma mark - KinectLiveSource
+
+// consumes a signaled frame arrived event, false when nothing new arrived
+template<class Args, class Reader>
+static bool resetFrameArrived(Reader* reader, WAITABLE_HANDLE handle)
+{
+	if (WaitForSingleObject(reinterpret_cast<HANDLE>(handle), 0) != WAIT_OBJECT_0)return false;
+
+	Args* args = nullptr;
+	reader->GetFrameArrivedEventData(handle, &args);
+	SafeRelease(args);
+	return true;
+}
+
+KinectLiveSource::KinectLiveSource()
+	: mode(KINECT_SOURCE_FACE)
+	, sensor(nullptr)
+	, colorFrameReader(nullptr)
+	, bodyFrameReader(nullptr)
+	, coordinateMapper(nullptr)
+	, colorFrameEvent(0)
+	, bodyFrameEvent(0)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		bodyTrackingIds[i] = 0;
+		isFaceTracked[i] = false;
+		faceFrameEvents[i] = 0;
+		faceFrameSources[i] = nullptr;
+		faceFrameReaders[i] = nullptr;
+		hdFaceFrameSources[i] = nullptr;
+		hdFaceFrameReaders[i] = nullptr;
+		faceModelBuilders[i] = nullptr;
+		faceModel[i] = nullptr;
+		faceAlignment[i] = nullptr;
+		modelStatus[i] = KINECT_MODEL_GENERIC;
+		modelTrackingIds[i] = 0;
+		hasVertexKey[i] = false;
+	}
+}
+
+KinectLiveSource::~KinectLiveSource()
+{
+	close();
+}
+
+bool KinectLiveSource::open(KinectSourceMode mode, int frames)
+{
+	this->mode = mode;
+
+	HRESULT hr = GetDefaultKinectSensor(&sensor);
+
+	if(sensor)
+	{
+		IColorFrameSource*	colorFrameSource = nullptr;
+		IBodyFrameSource*	bodyFrameSource = nullptr;
+
+		hr = sensor->Open();
+
+		// the color stream is only opened when someone consumes it
+		if (SUCCEEDED(hr) && (frames & KINECT_FRAME_COLOR))
+		{
+			hr = sensor->get_ColorFrameSource(&colorFrameSource);
+
+			if (SUCCEEDED(hr))
+			{
+				hr = colorFrameSource->OpenReader(&colorFrameReader);
+			}
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = sensor->get_BodyFrameSource(&bodyFrameSource);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = bodyFrameSource->OpenReader(&bodyFrameReader);
+		}
+
+		if (SUCCEEDED(hr)){
+			hr = sensor->get_CoordinateMapper( &coordinateMapper );
+		}
+
+		SafeRelease(colorFrameSource);
+		SafeRelease(bodyFrameSource);
+	}
+
+	for (int i = 0; i < BODY_COUNT && SUCCEEDED(hr); i++)
+	{
+		if (mode == KINECT_SOURCE_FACE)
+		{
+			hr = CreateFaceFrameSource(sensor, 0, faceFeatures, &faceFrameSources[i]);
+			if (SUCCEEDED(hr))
+			{
+				hr = faceFrameSources[i]->OpenReader(&faceFrameReaders[i]);
+			}
+		}
+		else
+		{
+			hr = CreateHighDefinitionFaceFrameSource(sensor, &hdFaceFrameSources[i]);
+			if (SUCCEEDED(hr))
+			{
+				hr = hdFaceFrameSources[i]->OpenReader(&hdFaceFrameReaders[i]);
+			}
+			if (SUCCEEDED(hr))
+			{
+				hr = CreateFaceAlignment( &faceAlignment[i] );
+			}
+			if (SUCCEEDED(hr))
+			{
+				hr = resetFaceModel(i);
+			}
+		}
+	}
+
+	// readers signal these on arrival, failing to subscribe just falls back to polling
+	if (SUCCEEDED(hr))
+	{
+		if (colorFrameReader && FAILED(colorFrameReader->SubscribeFrameArrived(&colorFrameEvent)))colorFrameEvent = 0;
+		if (bodyFrameReader && FAILED(bodyFrameReader->SubscribeFrameArrived(&bodyFrameEvent)))bodyFrameEvent = 0;
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			HRESULT subscribed = (mode == KINECT_SOURCE_FACE)
+				? faceFrameReaders[i]->SubscribeFrameArrived(&faceFrameEvents[i])
+				: hdFaceFrameReaders[i]->SubscribeFrameArrived(&faceFrameEvents[i]);
+			if (FAILED(subscribed))faceFrameEvents[i] = 0;
+		}
+	}
+
+	return sensor && SUCCEEDED(hr);
+}
+
+void KinectLiveSource::close()
+{
+	if (colorFrameEvent)colorFrameReader->UnsubscribeFrameArrived(colorFrameEvent);
+	if (bodyFrameEvent)bodyFrameReader->UnsubscribeFrameArrived(bodyFrameEvent);
+	colorFrameEvent = bodyFrameEvent = 0;
+
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		if (faceFrameEvents[i] && faceFrameReaders[i])faceFrameReaders[i]->UnsubscribeFrameArrived(faceFrameEvents[i]);
+		if (faceFrameEvents[i] && hdFaceFrameReaders[i])hdFaceFrameReaders[i]->UnsubscribeFrameArrived(faceFrameEvents[i]);
+		faceFrameEvents[i] = 0;
+		isFaceTracked[i] = false;
+	}
+
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		SafeRelease(faceFrameReaders[i]);
+		SafeRelease(faceFrameSources[i]);
+		SafeRelease(hdFaceFrameReaders[i]);
+		SafeRelease(faceModelBuilders[i]);
+		SafeRelease(hdFaceFrameSources[i]);
+		SafeRelease(faceAlignment[i]);
+		SafeRelease(faceModel[i]);
+		modelStatus[i] = KINECT_MODEL_GENERIC;
+		modelTrackingIds[i] = 0;
+	}
+	SafeRelease(coordinateMapper);
+	SafeRelease(colorFrameReader);
+	SafeRelease(bodyFrameReader);
+
+	if (!sensor) {
+		return;
+	}
+
+	sensor->Close();
+	SafeRelease(sensor);
+}
+
+bool KinectLiveSource::acquireColor(ofPixels& pixels, INT64& time)
+{
+	if(!colorFrameReader)
+	{
+		return false;
+	}
+
+	if (colorFrameEvent && !resetFrameArrived<IColorFrameArrivedEventArgs>(colorFrameReader, colorFrameEvent))
+	{
+		return false;
+	}
+
+	bool isAcquired = false;
+	IColorFrame* colorFrame = NULL;
+	HRESULT hr = colorFrameReader->AcquireLatestFrame(&colorFrame);
+
+	if(SUCCEEDED(hr))
+	{
+		hr = colorFrame->get_RelativeTime(&time);
+
+		IFrameDescription* description = NULL;
+		int width = 0;
+		int height = 0;
+		ColorImageFormat imageFormat = ColorImageFormat_None;
+		ColorImageFormat targetFormat = pixels.getNumChannels() == 2 ? ColorImageFormat_Yuy2 : ColorImageFormat_Rgba;
+
+		if (SUCCEEDED(hr))
+		{
+			hr = colorFrame->get_FrameDescription(&description);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = description->get_Width(&width);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = description->get_Height(&height);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = colorFrame->get_RawColorImageFormat(&imageFormat);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			if (width == COLOR_WIDTH && height == COLOR_HEIGHT && pixels.getWidth() == width && pixels.getHeight() == height)
+			{
+				// a plain copy when the sensor already delivers the wanted format
+				if (imageFormat == targetFormat)
+				{
+					hr = colorFrame->CopyRawFrameDataToArray(pixels.size(), pixels.getPixels());
+				}
+				else
+				{
+					KinectScopedTimer timer(stats, KINECT_STAGE_CONVERT);
+					hr = colorFrame->CopyConvertedFrameDataToArray(pixels.size(), pixels.getPixels(), targetFormat);
+				}
+				isAcquired = SUCCEEDED(hr);
+			}
+		}
+		SafeRelease(description);
+	}
+
+	SafeRelease(colorFrame);
+
+	return isAcquired;
+}
+
+bool KinectLiveSource::skipColor(INT64& time)
+{
+	if(!colorFrameReader)
+	{
+		return false;
+	}
+
+	if (colorFrameEvent && !resetFrameArrived<IColorFrameArrivedEventArgs>(colorFrameReader, colorFrameEvent))
+	{
+		return false;
+	}
+
+	IColorFrame* colorFrame = NULL;
+	HRESULT hr = colorFrameReader->AcquireLatestFrame(&colorFrame);
+	if (SUCCEEDED(hr))
+	{
+		hr = colorFrame->get_RelativeTime(&time);
+	}
+	SafeRelease(colorFrame);
+	return SUCCEEDED(hr);
+}
+
+bool KinectLiveSource::acquireBodies(UINT64* trackingIds, INT64& time)
+{
+	if (bodyFrameReader == nullptr)
+	{
+		return false;
+	}
+
+	if (bodyFrameEvent && !resetFrameArrived<IBodyFrameArrivedEventArgs>(bodyFrameReader, bodyFrameEvent))
+	{
+		return false;
+	}
+
+	IBody* bodies[BODY_COUNT] = {0};
+	IBodyFrame* pBodyFrame = nullptr;
+	HRESULT hr = bodyFrameReader->AcquireLatestFrame(&pBodyFrame);
+	if (SUCCEEDED(hr))
+	{
+		hr = pBodyFrame->get_RelativeTime(&time);
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = pBodyFrame->GetAndRefreshBodyData(BODY_COUNT, bodies);
+	}
+	SafeRelease(pBodyFrame);
+
+	if (SUCCEEDED(hr))
+	{
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			BOOLEAN tracked = false;
+			UINT64 trackID = 0;
+			if (bodies[i] != nullptr && SUCCEEDED(bodies[i]->get_IsTracked(&tracked)) && tracked)
+			{
+				bodies[i]->get_TrackingId(&trackID);
+			}
+			bodyTrackingIds[i] = trackingIds[i] = trackID;
+			SafeRelease(bodies[i]);
+
+			// a slot without a body has nothing left to track
+			if (trackID == 0)
+			{
+				isFaceTracked[i] = false;
+			}
+
+			// idle face readers may not deliver frames to retarget from
+			if (!isFaceTracked[i])
+			{
+				updateTrackingId(i);
+			}
+		}
+	}
+
+	return SUCCEEDED(hr);
+}
+
+// points an idle face source at the body tracked in the same slot
+void KinectLiveSource::updateTrackingId(int idx)
+{
+	if (bodyTrackingIds[idx] == 0)return;
+
+	if (mode == KINECT_SOURCE_FACE)
+	{
+		faceFrameSources[idx]->put_TrackingId(bodyTrackingIds[idx]);
+	}
+	else
+	{
+		hdFaceFrameSources[idx]->put_TrackingId(bodyTrackingIds[idx]);
+
+		// a fitted model belongs to one person, the next one starts from the generic model
+		if (modelTrackingIds[idx] != bodyTrackingIds[idx])
+		{
+			if (modelTrackingIds[idx] != 0)
+			{
+				resetFaceModel(idx);
+			}
+			modelTrackingIds[idx] = bodyTrackingIds[idx];
+		}
+	}
+}
+
+// generic model and a new collection
+HRESULT KinectLiveSource::resetFaceModel(int idx)
+{
+	SafeRelease(faceModelBuilders[idx]);
+	SafeRelease(faceModel[idx]);
+	modelStatus[idx] = KINECT_MODEL_GENERIC;
+	hasVertexKey[idx] = false;
+
+	std::vector<float> deformations( FaceShapeDeformations::FaceShapeDeformations_Count, 0.f );
+	HRESULT hr = CreateFaceModel( 1.0f, FaceShapeDeformations::FaceShapeDeformations_Count, &deformations[0], &faceModel[idx] );
+	if (SUCCEEDED(hr))
+	{
+		hr = hdFaceFrameSources[idx]->OpenModelBuilder( FaceModelBuilderAttributes::FaceModelBuilderAttributes_None, &faceModelBuilders[idx] );
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = faceModelBuilders[idx]->BeginFaceDataCollection();
+	}
+	if (SUCCEEDED(hr))
+	{
+		modelStatus[idx] = KINECT_MODEL_COLLECTING;
+	}
+	return hr;
+}
+
+// swaps in the fitted model once the builder has seen enough views, never waits
+void KinectLiveSource::pollFaceModel(int idx)
+{
+	if (modelStatus[idx] != KINECT_MODEL_COLLECTING || !faceModelBuilders[idx])return;
+
+	FaceModelBuilderCollectionStatus status;
+	if (FAILED(faceModelBuilders[idx]->get_CollectionStatus(&status)) || status != FaceModelBuilderCollectionStatus_Complete)return;
+
+	IFaceModelData* data = nullptr;
+	IFaceModel* model = nullptr;
+	HRESULT hr = faceModelBuilders[idx]->GetFaceData(&data);
+	if (SUCCEEDED(hr) && data)
+	{
+		hr = data->ProduceFaceModel(&model);
+	}
+	SafeRelease(data);
+
+	if (SUCCEEDED(hr) && model)
+	{
+		SafeRelease(faceModel[idx]);
+		faceModel[idx] = model;
+		modelStatus[idx] = KINECT_MODEL_FITTED;
+		hasVertexKey[idx] = false;
+		SafeRelease(faceModelBuilders[idx]);
+	}
+}
+
+KinectFaceModelStatus KinectLiveSource::getFaceModelStatus(int idx)
+{
+	return (idx>=0 && idx<BODY_COUNT) ? modelStatus[idx] : KINECT_MODEL_GENERIC;
+}
+
+bool KinectLiveSource::getFaceModel(int idx, KinectFaceModel& model)
+{
+	if (idx<0 || idx>=BODY_COUNT || !faceModel[idx])return false;
+
+	HRESULT hr = faceModel[idx]->get_Scale(&model.scale);
+	if (SUCCEEDED(hr))
+	{
+		hr = faceModel[idx]->GetFaceShapeDeformations(FaceShapeDeformations_Count, model.deformations);
+	}
+	return SUCCEEDED(hr);
+}
+
+bool KinectLiveSource::setFaceModel(int idx, const KinectFaceModel& model)
+{
+	if (idx<0 || idx>=BODY_COUNT || mode != KINECT_SOURCE_HD_FACE)return false;
+
+	KinectFaceModel copy = model;
+	IFaceModel* created = nullptr;
+	HRESULT hr = CreateFaceModel(copy.scale, FaceShapeDeformations_Count, copy.deformations, &created);
+	if (FAILED(hr) || !created)return false;
+
+	SafeRelease(faceModel[idx]);
+	SafeRelease(faceModelBuilders[idx]);
+	faceModel[idx] = created;
+	modelStatus[idx] = KINECT_MODEL_FITTED;
+	hasVertexKey[idx] = false;
+	return true;
+}
+
+bool KinectLiveSource::acquireFaces(KinectFaceData* faces)
+{
+	if (mode != KINECT_SOURCE_FACE || !faceFrameReaders[0])return false;
+
+	HRESULT hr;
+
+	for (int i = 0; i < BODY_COUNT; ++i)
+	{
+		faces[i].isUpdated = false;
+		if (!faces[i].isActive)continue;
+
+		if (faceFrameEvents[i] && !resetFrameArrived<IFaceFrameArrivedEventArgs>(faceFrameReaders[i], faceFrameEvents[i]))
+		{
+			continue;
+		}
+
+		IFaceFrame* faceFrame = nullptr;
+		hr = faceFrameReaders[i]->AcquireLatestFrame(&faceFrame);
+
+		BOOLEAN trackingIdValid = FALSE;
+		if (SUCCEEDED(hr) && nullptr != faceFrame)
+		{
+			hr = faceFrame->get_IsTrackingIdValid(&trackingIdValid);
+			isFaceTracked[i] = SUCCEEDED(hr) && trackingIdValid;
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			if (trackingIdValid)
+			{
+				IFaceFrameResult* faceFrameResult = nullptr;
+
+				hr = faceFrame->get_FaceFrameResult(&faceFrameResult);
+
+				// only the requested outputs are read
+				if (SUCCEEDED(hr) && faceFrameResult != nullptr)
+				{
+					if (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_BoundingBoxInColorSpace)
+					{
+						hr = faceFrameResult->get_FaceBoundingBoxInColorSpace(&faces[i].boundingBox);
+					}
+
+					if (SUCCEEDED(hr) && (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_PointsInColorSpace))
+					{
+						hr = faceFrameResult->GetFacePointsInColorSpace(FacePointType::FacePointType_Count, faces[i].points);
+					}
+
+					if (SUCCEEDED(hr) && (faceFeatures & FaceFrameFeatures::FaceFrameFeatures_RotationOrientation))
+					{
+						hr = faceFrameResult->get_FaceRotationQuaternion(&faces[i].rotation);
+					}
+
+					if (SUCCEEDED(hr) && (faceFeatures & KINECT_FACE_FEATURE_PROPERTIES))
+					{
+						hr = faceFrameResult->GetFaceProperties(FaceProperty::FaceProperty_Count, faces[i].properties);
+					}
+
+					if (SUCCEEDED(hr))
+					{
+						hr = faceFrame->get_TrackingId(&faces[i].trackingId);
+						faces[i].isUpdated = SUCCEEDED(hr);
+					}
+				}
+
+				SafeRelease(faceFrameResult);
+			}
+			else
+			{
+				updateTrackingId(i);
+			}
+		}
+
+		SafeRelease(faceFrame);
+	}
+
+	return true;
+}
+
+bool KinectLiveSource::acquireHDFaces(KinectHDFaceData* hdFaces)
+{
+	if (mode != KINECT_SOURCE_HD_FACE || !hdFaceFrameReaders[0])return false;
+
+	HRESULT hr;
+
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		hdFaces[i].isUpdated = false;
+		hdFaces[i].isVertexUpdated = false;
+		if (!hdFaces[i].isActive)
+		{
+			hasVertexKey[i] = false;
+			continue;
+		}
+
+		if (faceFrameEvents[i] && !resetFrameArrived<IHighDefinitionFaceFrameArrivedEventArgs>(hdFaceFrameReaders[i], faceFrameEvents[i]))
+		{
+			continue;
+		}
+
+		IHighDefinitionFaceFrame * faceFrame = nullptr;
+		hr = hdFaceFrameReaders[i]->AcquireLatestFrame(&faceFrame);
+
+		BOOLEAN trackingIdValid = FALSE;
+		if (SUCCEEDED(hr) && nullptr != faceFrame)
+		{
+			hr = faceFrame->get_IsTrackingIdValid(&trackingIdValid);
+			isFaceTracked[i] = SUCCEEDED(hr) && trackingIdValid;
+		}
+
+		if (SUCCEEDED(hr) && trackingIdValid)
+		{
+			pollFaceModel(i);
+			{
+				KinectScopedTimer timer(stats, KINECT_STAGE_ALIGNMENT);
+				hr = faceFrame->GetAndRefreshFaceAlignmentResult(faceAlignment[i]);
+			}
+
+			if(SUCCEEDED(hr) && faceAlignment[i] != nullptr)
+			{
+				hr = faceAlignment[i]->GetAnimationUnits(FaceShapeAnimations_Count, hdFaces[i].animationUnits);
+
+				if (SUCCEEDED(hr))
+				{
+					hr = faceAlignment[i]->get_HeadPivotPoint(&hdFaces[i].headPivot);
+				}
+
+				if (SUCCEEDED(hr))
+				{
+					hr = faceAlignment[i]->get_FaceOrientation(&hdFaces[i].orientation);
+				}
+
+				// the vertices only depend on the model and these inputs
+				if (SUCCEEDED(hr) && hdFaces[i].isVertexRequested && hdFaces[i].vertices && hdFaces[i].vertexCount > 0)
+				{
+					AlignmentKey key;
+					key.headPivot = hdFaces[i].headPivot;
+					key.orientation = hdFaces[i].orientation;
+					memcpy(key.animationUnits, hdFaces[i].animationUnits, sizeof(key.animationUnits));
+					if (!hasVertexKey[i] || memcmp(&key, &vertexKeys[i], sizeof(key)) != 0)
+					{
+						KinectScopedTimer timer(stats, KINECT_STAGE_VERTICES);
+						hr = faceModel[i]->CalculateVerticesForAlignment(faceAlignment[i], hdFaces[i].vertexCount, hdFaces[i].vertices);
+						hdFaces[i].isVertexUpdated = SUCCEEDED(hr);
+						vertexKeys[i] = key;
+					}
+				}
+
+				if (SUCCEEDED(hr))
+				{
+					hr = faceFrame->get_TrackingId(&hdFaces[i].trackingId);
+					hdFaces[i].isUpdated = SUCCEEDED(hr);
+				}
+			}
+		}
+		else
+		{
+			updateTrackingId(i);
+		}
+
+		// the caller keeps its last vertices for faces that were not updated
+		hasVertexKey[i] = hdFaces[i].isUpdated && (hasVertexKey[i] || hdFaces[i].isVertexUpdated);
+
+		SafeRelease(faceFrame);
+	}
+
+	return true;
+}
+
+// blocks until the stream that paces the pipeline signals a new frame
+bool KinectLiveSource::waitForFrame(DWORD timeoutMillis)
+{
+	HANDLE events[2];
+	DWORD count = 0;
+	if (colorFrameEvent)events[count++] = reinterpret_cast<HANDLE>(colorFrameEvent);
+	if (bodyFrameEvent)events[count++] = reinterpret_cast<HANDLE>(bodyFrameEvent);
+	// nothing to wait on, polling must not spin
+	if (count == 0)
+	{
+		ofSleepMillis(timeoutMillis);
+		return false;
+	}
+
+	DWORD result = WaitForMultipleObjects(count, events, FALSE, timeoutMillis);
+	return result < WAIT_OBJECT_0 + count;
+}
+
+bool KinectLiveSource::getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles)
+{
+	HRESULT hr = GetFaceModelVertexCount( &vertexCount );
+
+	UINT32 triangleCount = 0;
+	if (SUCCEEDED(hr))
+	{
+		hr = GetFaceModelTriangleCount(&triangleCount);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		triangles.assign(triangleCount*3, 0);
+		hr = GetFaceModelTriangles(triangles.size(), &triangles[0]);
+	}
+
+	return SUCCEEDED(hr);
+}
+
+bool KinectLiveSource::mapCameraToColor(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count)
+{
+	if (!coordinateMapper || count == 0)
+	{
+		return false;
+	}
+
+	HRESULT hr = coordinateMapper->MapCameraPointsToColorSpace( count, src, count, dst );
+	return SUCCEEDED(hr);
+}
+
+KinectColorProjection KinectLiveSource::getColorProjection()
+{
+	projection.fit(coordinateMapper);
+	return projection;
+}
+
+#pragma mark - KinectRecorder
+
+KinectRecorder::KinectRecorder(KinectFrameSource* source, const std::string& path, bool recordColor)
+	: source(source)
+	, path(path)
+	, recordColor(recordColor)
+	, frames(KINECT_FRAME_ALL)
+	, file(NULL)
+	, frameTime(0)
+	, vertexEncoder(1)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		recordedModelIds[i] = 0;
+	}
+}
+
+KinectRecorder::~KinectRecorder()
+{
+	close();
+	delete source;
+}
+
+bool KinectRecorder::open(KinectSourceMode mode, int frames)
+{
+	this->frames = frames;
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		recordedModelIds[i] = 0;
+	}
+
+	if (!source->open(mode, frames))
+	{
+		return false;
+	}
+
+	file = fopen(ofToDataPath(path).c_str(), "wb");
+	if (!file)
+	{
+		ofLogError("KinectRecorder") << "could not open " << path;
+		return false;
+	}
+
+	RecordHeader header;
+	memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	header.version = RECORD_VERSION;
+	header.mode = mode;
+	header.frames = frames;
+	fwrite(&header, sizeof(header), 1, file);
+
+	projection = source->getColorProjection();
+	writeChunk(CHUNK_PROJECTION, 0, &projection, sizeof(projection));
+	if (mode == KINECT_SOURCE_FACE)
+	{
+		UINT32 features = faceFeatures;
+		writeChunk(CHUNK_FACE_FEATURES, 0, &features, sizeof(features));
+	}
+
+	UINT32 vertexCount = 0;
+	std::vector<UINT32> triangles;
+	if (mode == KINECT_SOURCE_HD_FACE && source->getFaceTopology(vertexCount, triangles))
+	{
+		chunk.resize(sizeof(UINT32) * (1 + triangles.size()));
+		memcpy(&chunk[0], &vertexCount, sizeof(UINT32));
+		memcpy(&chunk[sizeof(UINT32)], &triangles[0], sizeof(UINT32) * triangles.size());
+		writeChunk(CHUNK_TOPOLOGY, 0, &chunk[0], chunk.size());
+	}
+
+	return true;
+}
+
+void KinectRecorder::close()
+{
+	if (file)
+	{
+		fclose(file);
+		file = NULL;
+	}
+	source->close();
+}
+
+void KinectRecorder::writeChunk(UINT32 type, INT64 time, const void* data, UINT32 size)
+{
+	if (!file)return;
+
+	ChunkHeader header = { type, size, time };
+	fwrite(&header, sizeof(header), 1, file);
+	if (size > 0)
+	{
+		fwrite(data, size, 1, file);
+	}
+}
+
+bool KinectRecorder::acquireColor(ofPixels& pixels, INT64& time)
+{
+	if (!source->acquireColor(pixels, time))
+	{
+		return false;
+	}
+
+	writeFrame(&pixels, time);
+	return true;
+}
+
+bool KinectRecorder::waitForFrame(DWORD timeoutMillis)
+{
+	return source->waitForFrame(timeoutMillis);
+}
+
+bool KinectRecorder::isExhausted()
+{
+	return source->isExhausted();
+}
+
+// the frame is recorded without pixels
+bool KinectRecorder::skipColor(INT64& time)
+{
+	if (!source->skipColor(time))
+	{
+		return false;
+	}
+
+	writeFrame(nullptr, time);
+	return true;
+}
+
+// starts a new frame, with or without its color pixels
+void KinectRecorder::writeFrame(const ofPixels* pixels, INT64 time)
+{
+	frameTime = time;
+
+	if (!pixels)
+	{
+		FrameRecord frame = { 0, 0, 0, 0 };
+		writeChunk(CHUNK_FRAME, time, &frame, sizeof(frame));
+		return;
+	}
+
+	FrameRecord frame = { (UINT32)pixels->getWidth(), (UINT32)pixels->getHeight(), (UINT32)pixels->getNumChannels(), 0 };
+	UINT32 pixelSize = recordColor ? frame.width * frame.height * frame.channels : 0;
+	ChunkHeader header = { CHUNK_FRAME, (UINT32)sizeof(frame) + pixelSize, time };
+	if (file)
+	{
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(&frame, sizeof(frame), 1, file);
+		if (pixelSize > 0)
+		{
+			fwrite(pixels->getPixels(), pixelSize, 1, file);
+		}
+	}
+}
+
+bool KinectRecorder::acquireBodies(UINT64* trackingIds, INT64& time)
+{
+	if (!source->acquireBodies(trackingIds, time))
+	{
+		return false;
+	}
+
+	// without color the body frames pace the recording
+	if (!(frames & KINECT_FRAME_COLOR))
+	{
+		writeFrame(nullptr, time);
+	}
+	writeChunk(CHUNK_BODIES, time, trackingIds, sizeof(UINT64) * BODY_COUNT);
+	return true;
+}
+
+bool KinectRecorder::acquireFaces(KinectFaceData* faces)
+{
+	if (!source->acquireFaces(faces))
+	{
+		return false;
+	}
+
+	writeChunk(CHUNK_FACES, frameTime, faces, sizeof(KinectFaceData) * BODY_COUNT);
+	return true;
+}
+
+bool KinectRecorder::acquireHDFaces(KinectHDFaceData* hdFaces)
+{
+	if (!source->acquireHDFaces(hdFaces))
+	{
+		return false;
+	}
+
+	chunk.clear();
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		HDFaceRecord record = {0};
+		record.isUpdated = hdFaces[i].isUpdated;
+		record.vertexCount = hdFaces[i].isUpdated && hdFaces[i].vertices ? hdFaces[i].vertexCount : 0;
+		record.trackingId = hdFaces[i].trackingId;
+		record.headPivot = hdFaces[i].headPivot;
+		record.orientation = hdFaces[i].orientation;
+		memcpy(record.animationUnits, hdFaces[i].animationUnits, sizeof(record.animationUnits));
+
+		// unchanged faces carry the vertices last calculated for them
+		if (record.vertexCount > 0 && hdFaces[i].isVertexUpdated)
+		{
+			lastVertices[i].assign(hdFaces[i].vertices, hdFaces[i].vertices + record.vertexCount);
+		}
+		encoded.clear();
+		if (record.vertexCount > 0 && lastVertices[i].size() == record.vertexCount)
+		{
+			vertexEncoder.encode(record.headPivot, lastVertices[i].data(), record.vertexCount, encoded);
+		}
+		record.vertexBytes = encoded.size();
+
+		const char* p = (const char*)&record;
+		chunk.insert(chunk.end(), p, p + sizeof(record));
+		chunk.insert(chunk.end(), encoded.begin(), encoded.end());
+	}
+	writeChunk(CHUNK_HD_FACES, frameTime, &chunk[0], chunk.size());
+
+	// fitted shapes let replays identify returning persons
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		if(!hdFaces[i].isUpdated || recordedModelIds[i] == hdFaces[i].trackingId)continue;
+		if(source->getFaceModelStatus(i) != KINECT_MODEL_FITTED)continue;
+
+		FaceModelRecord record;
+		record.slot = i;
+		record.reserved = 0;
+		record.trackingId = hdFaces[i].trackingId;
+		if (source->getFaceModel(i, record.model))
+		{
+			writeChunk(CHUNK_FACE_MODEL, frameTime, &record, sizeof(record));
+			recordedModelIds[i] = record.trackingId;
+		}
+	}
+	return true;
+}
+
+bool KinectRecorder::getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles)
+{
+	return source->getFaceTopology(vertexCount, triangles);
+}
+
+bool KinectRecorder::mapCameraToColor(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count)
+{
+	return source->mapCameraToColor(src, dst, count);
+}
+
+KinectColorProjection KinectRecorder::getColorProjection()
+{
+	return projection;
+}
+
+void KinectRecorder::setStats(KinectStats* stats)
+{
+	this->stats = stats;
+	source->setStats(stats);
+}
+
+void KinectRecorder::setFaceFeatures(DWORD features)
+{
+	faceFeatures = features;
+	source->setFaceFeatures(features);
+}
+
+KinectFaceModelStatus KinectRecorder::getFaceModelStatus(int idx)
+{
+	return source->getFaceModelStatus(idx);
+}
+
+bool KinectRecorder::getFaceModel(int idx, KinectFaceModel& model)
+{
+	return source->getFaceModel(idx, model);
+}
+
+bool KinectRecorder::setFaceModel(int idx, const KinectFaceModel& model)
+{
+	return source->setFaceModel(idx, model);
+}
+
+#pragma mark - KinectReplaySource
+
+KinectReplaySource::KinectReplaySource(const std::string& path, bool realtime, bool loop)
+	: path(path)
+	, isRealtime(realtime)
+	, isLooping(loop)
+	, frames(KINECT_FRAME_ALL)
+	, file(INVALID_HANDLE_VALUE)
+	, mapping(NULL)
+	, data(NULL)
+	, dataSize(0)
+	, version(0)
+	, topologyOffset(0)
+	, frameIndex(-1)
+	, bodyFrameIndex(-1)
+	, firstFrameTime(0)
+	, startMicros(0)
+	, recordedFeatures(KINECT_FACE_FEATURES_ALL)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		bodyTrackingIds[i] = 0;
+	}
+}
+
+KinectReplaySource::~KinectReplaySource()
+{
+	close();
+}
+
+bool KinectReplaySource::open(KinectSourceMode mode, int frames)
+{
+	this->frames = frames;
+
+	file = CreateFileA(ofToDataPath(path).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		ofLogError("KinectReplaySource") << "could not open " << path;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size))
+	{
+		dataSize = size.QuadPart;
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (mapping)
+	{
+		data = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+
+	const RecordHeader* header = (const RecordHeader*)data;
+	if (!data || dataSize < sizeof(RecordHeader) || memcmp(header->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 || header->version == 0)
+	{
+		ofLogError("KinectReplaySource") << path << " is not a recording";
+		close();
+		return false;
+	}
+	if (header->version > RECORD_VERSION)
+	{
+		ofLogError("KinectReplaySource") << path << " was written by a newer version " << header->version;
+		close();
+		return false;
+	}
+	version = header->version;
+	if (header->mode != mode)
+	{
+		ofLogError("KinectReplaySource") << path << " was recorded for the other face mode";
+		close();
+		return false;
+	}
+
+	// index the frames once so seeking and replay never scan the file,
+	// recordings without their features were made with all of them
+	recordedFeatures = KINECT_FACE_FEATURES_ALL;
+	frameOffsets.clear();
+	faceModels.clear();
+	UINT64 offset = sizeof(RecordHeader);
+	while (offset + sizeof(ChunkHeader) <= dataSize)
+	{
+		const ChunkHeader* chunk = (const ChunkHeader*)(data + offset);
+		if (offset + sizeof(ChunkHeader) + chunk->size > dataSize)break;
+
+		switch (chunk->type)
+		{
+		case CHUNK_FRAME:
+			frameOffsets.push_back(offset);
+			break;
+		case CHUNK_TOPOLOGY:
+			topologyOffset = offset;
+			break;
+		case CHUNK_PROJECTION:
+			if (chunk->size == sizeof(projection))
+			{
+				memcpy(&projection, chunk + 1, sizeof(projection));
+			}
+			break;
+		case CHUNK_FACE_FEATURES:
+			if (chunk->size == sizeof(UINT32))
+			{
+				recordedFeatures = *(const UINT32*)(chunk + 1);
+			}
+			break;
+		case CHUNK_FACE_MODEL:
+			if (chunk->size == sizeof(FaceModelRecord) && !frameOffsets.empty())
+			{
+				const FaceModelRecord* record = (const FaceModelRecord*)(chunk + 1);
+				RecordedModel recorded = { (int)frameOffsets.size() - 1, record->slot, record->trackingId, record->model };
+				faceModels.push_back(recorded);
+			}
+			break;
+		default:
+			break;
+		}
+		offset += sizeof(ChunkHeader) + chunk->size;
+	}
+	frameOffsets.push_back(offset);
+
+	frameIndex = -1;
+	bodyFrameIndex = -1;
+	return getFrameCount() > 0;
+}
+
+void KinectReplaySource::close()
+{
+	if (data)
+	{
+		UnmapViewOfFile(data);
+		data = NULL;
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+	frameOffsets.clear();
+	topologyOffset = 0;
+	dataSize = 0;
+	version = 0;
+}
+
+DWORD KinectReplaySource::getRecordedFaceFeatures()
+{
+	return recordedFeatures;
+}
+
+int KinectReplaySource::getFrameCount()
+{
+	return frameOffsets.empty() ? 0 : frameOffsets.size() - 1;
+}
+
+int KinectReplaySource::getFrameIndex()
+{
+	return frameIndex;
+}
+
+void KinectReplaySource::setFrameIndex(int index)
+{
+	frameIndex = ofClamp(index, 0, getFrameCount()) - 1;
+	startMicros = 0;
+}
+
+// moves to the next frame once it is due, or right away when not replaying in real time
+bool KinectReplaySource::advanceFrame(INT64& time)
+{
+	int next = frameIndex + 1;
+	if (next >= getFrameCount())
+	{
+		if (!isLooping || getFrameCount() == 0)return false;
+		next = 0;
+		startMicros = 0;
+	}
+
+	const ChunkHeader* chunk = (const ChunkHeader*)(data + frameOffsets[next]);
+	if (isRealtime)
+	{
+		unsigned long long now = ofGetElapsedTimeMicros();
+		if (startMicros == 0)
+		{
+			startMicros = now;
+			firstFrameTime = chunk->time;
+		}
+		// relative time is in 100ns ticks
+		if ((now - startMicros) * 10 < (unsigned long long)(chunk->time - firstFrameTime))return false;
+	}
+
+	frameIndex = next;
+	time = chunk->time;
+	return true;
+}
+
+// sleeps until the next recorded frame is due
+bool KinectReplaySource::waitForFrame(DWORD timeoutMillis)
+{
+	if (isExhausted())return false;
+	if (!isRealtime || startMicros == 0)return true;
+
+	int next = frameIndex + 1;
+	if (next >= getFrameCount())
+	{
+		return true;
+	}
+
+	const ChunkHeader* chunk = (const ChunkHeader*)(data + frameOffsets[next]);
+	unsigned long long due = startMicros + (chunk->time - firstFrameTime) / 10;
+	unsigned long long now = ofGetElapsedTimeMicros();
+	if (due > now)
+	{
+		unsigned long long waitMillis = (due - now + 999) / 1000;
+		if (waitMillis > timeoutMillis)
+		{
+			ofSleepMillis(timeoutMillis);
+			return false;
+		}
+		ofSleepMillis(waitMillis);
+	}
+	return true;
+}
+
+// the last frame was replayed and the recording does not loop
+bool KinectReplaySource::isExhausted()
+{
+	return !data || (!isLooping && frameIndex + 1 >= getFrameCount());
+}
+
+bool KinectReplaySource::acquireColor(ofPixels& pixels, INT64& time)
+{
+	if (!(frames & KINECT_FRAME_COLOR) || !advanceFrame(time))
+	{
+		return false;
+	}
+
+	const ChunkHeader* chunk = (const ChunkHeader*)(data + frameOffsets[frameIndex]);
+	FrameRecord frame = { 0, 0, 4, 0 };
+	size_t recordSize = sizeof(FrameRecord);
+	if (version < 2)
+	{
+		// rgba only
+		recordSize = sizeof(FrameRecordV1);
+		if (chunk->size >= recordSize)
+		{
+			const FrameRecordV1* record = (const FrameRecordV1*)(chunk + 1);
+			frame.width = record->width;
+			frame.height = record->height;
+		}
+	}
+	else if (chunk->size >= recordSize)
+	{
+		frame = *(const FrameRecord*)(chunk + 1);
+	}
+
+	const BYTE* recorded = (const BYTE*)(chunk + 1) + recordSize;
+	if (chunk->size > recordSize && frame.width == pixels.getWidth() && frame.height == pixels.getHeight())
+	{
+		if (frame.channels == pixels.getNumChannels())
+		{
+			memcpy(pixels.getPixels(), recorded, pixels.size());
+		}
+		else if (frame.channels == 2 && pixels.getNumChannels() == 4)
+		{
+			KinectScopedTimer timer(stats, KINECT_STAGE_CONVERT);
+			KinectConvertYuy2ToRgba(recorded, pixels.getPixels(), frame.width * frame.height);
+		}
+	}
+	return true;
+}
+
+bool KinectReplaySource::skipColor(INT64& time)
+{
+	return (frames & KINECT_FRAME_COLOR) && advanceFrame(time);
+}
+
+bool KinectReplaySource::acquireBodies(UINT64* trackingIds, INT64& time)
+{
+	// color frames drive the replay when they are consumed, otherwise body frames do
+	if (!(frames & KINECT_FRAME_COLOR) && !advanceFrame(time))
+	{
+		return false;
+	}
+	if (bodyFrameIndex == frameIndex)
+	{
+		return false;
+	}
+
+	UINT32 size = 0;
+	const BYTE* chunk = findChunk(CHUNK_BODIES, size);
+	if (!chunk || size != sizeof(UINT64) * BODY_COUNT)
+	{
+		return false;
+	}
+
+	bodyFrameIndex = frameIndex;
+	time = ((const ChunkHeader*)chunk - 1)->time;
+	memcpy(trackingIds, chunk, size);
+	memcpy(bodyTrackingIds, chunk, size);
+	return true;
+}
+
+// finds a chunk of the given type inside the current frame
+const BYTE* KinectReplaySource::findChunk(UINT32 type, UINT32& size)
+{
+	if (frameIndex < 0 || frameIndex >= getFrameCount())return NULL;
+
+	const ChunkHeader* frame = (const ChunkHeader*)(data + frameOffsets[frameIndex]);
+	UINT64 offset = frameOffsets[frameIndex] + sizeof(ChunkHeader) + frame->size;
+	while (offset < frameOffsets[frameIndex + 1])
+	{
+		const ChunkHeader* chunk = (const ChunkHeader*)(data + offset);
+		if (chunk->type == type)
+		{
+			size = chunk->size;
+			return (const BYTE*)(chunk + 1);
+		}
+		offset += sizeof(ChunkHeader) + chunk->size;
+	}
+	return NULL;
+}
+
+bool KinectReplaySource::acquireFaces(KinectFaceData* faces)
+{
+	UINT32 size = 0;
+	const BYTE* chunk = findChunk(CHUNK_FACES, size);
+	if (!chunk || size != sizeof(KinectFaceData) * BODY_COUNT)
+	{
+		for (int i = 0; i < BODY_COUNT; i++)
+		{
+			faces[i].isUpdated = false;
+		}
+		return false;
+	}
+
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		bool isActive = faces[i].isActive;
+		memcpy(&faces[i], chunk + sizeof(KinectFaceData) * i, sizeof(KinectFaceData));
+		faces[i].isActive = isActive;
+		faces[i].isUpdated = isActive && faces[i].isUpdated;
+	}
+	return true;
+}
+
+bool KinectReplaySource::acquireHDFaces(KinectHDFaceData* hdFaces)
+{
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		hdFaces[i].isUpdated = false;
+		hdFaces[i].isVertexUpdated = false;
+	}
+
+	UINT32 size = 0;
+	const BYTE* chunk = findChunk(CHUNK_HD_FACES, size);
+	if (!chunk)return false;
+
+	const BYTE* end = chunk + size;
+	if (version < 3)
+	{
+		return acquireHDFacesV1(chunk, end, hdFaces);
+	}
+
+	for (int i = 0; i < BODY_COUNT && chunk + sizeof(HDFaceRecord) <= end; i++)
+	{
+		const HDFaceRecord* record = (const HDFaceRecord*)chunk;
+		chunk += sizeof(HDFaceRecord);
+
+		UINT32 vertexBytes = record->vertexBytes;
+		if (chunk + vertexBytes > end)break;
+
+		if (!hdFaces[i].isActive)
+		{
+			chunk += vertexBytes;
+			continue;
+		}
+
+		hdFaces[i].isUpdated = record->isUpdated != 0;
+		hdFaces[i].trackingId = record->trackingId;
+		hdFaces[i].headPivot = record->headPivot;
+		hdFaces[i].orientation = record->orientation;
+		memcpy(hdFaces[i].animationUnits, record->animationUnits, sizeof(record->animationUnits));
+		if (hdFaces[i].isVertexRequested && hdFaces[i].vertices && record->vertexCount == hdFaces[i].vertexCount && vertexBytes > 0)
+		{
+			KinectScopedTimer timer(stats, KINECT_STAGE_VERTICES);
+			hdFaces[i].isVertexUpdated = vertexDecoder.decode(chunk, vertexBytes, hdFaces[i].vertices, record->vertexCount);
+		}
+		chunk += vertexBytes;
+	}
+	return true;
+}
+
+// hd face chunks of versions 1 and 2 carry raw vertices
+bool KinectReplaySource::acquireHDFacesV1(const BYTE* chunk, const BYTE* end, KinectHDFaceData* hdFaces)
+{
+	for (int i = 0; i < BODY_COUNT && chunk + sizeof(HDFaceRecordV1) <= end; i++)
+	{
+		const HDFaceRecordV1* record = (const HDFaceRecordV1*)chunk;
+		chunk += sizeof(HDFaceRecordV1);
+
+		UINT32 vertexBytes = sizeof(CameraSpacePoint) * record->vertexCount;
+		if (chunk + vertexBytes > end)break;
+
+		if (!hdFaces[i].isActive)
+		{
+			chunk += vertexBytes;
+			continue;
+		}
+
+		hdFaces[i].isUpdated = record->isUpdated != 0;
+		hdFaces[i].trackingId = record->trackingId;
+		hdFaces[i].headPivot = record->headPivot;
+		hdFaces[i].orientation = record->orientation;
+		memcpy(hdFaces[i].animationUnits, record->animationUnits, sizeof(record->animationUnits));
+		if (hdFaces[i].isVertexRequested && hdFaces[i].vertices && record->vertexCount == hdFaces[i].vertexCount && vertexBytes > 0)
+		{
+			memcpy(hdFaces[i].vertices, chunk, vertexBytes);
+			hdFaces[i].isVertexUpdated = true;
+		}
+		chunk += vertexBytes;
+	}
+	return true;
+}
+
+// the recorded shape of the slot's current body, once the frame it was fitted in is reached
+const KinectFaceModel* KinectReplaySource::findFaceModel(int idx)
+{
+	if(idx<0 || idx>=BODY_COUNT || !bodyTrackingIds[idx])return nullptr;
+
+	for (size_t n = 0; n < faceModels.size(); n++)
+	{
+		const RecordedModel& recorded = faceModels[n];
+		if (recorded.frame > frameIndex)break;
+		if ((int)recorded.slot == idx && recorded.trackingId == bodyTrackingIds[idx])
+		{
+			return &recorded.model;
+		}
+	}
+	return nullptr;
+}
+
+KinectFaceModelStatus KinectReplaySource::getFaceModelStatus(int idx)
+{
+	return findFaceModel(idx) ? KINECT_MODEL_FITTED : KINECT_MODEL_GENERIC;
+}
+
+bool KinectReplaySource::getFaceModel(int idx, KinectFaceModel& model)
+{
+	const KinectFaceModel* recorded = findFaceModel(idx);
+	if (!recorded)return false;
+
+	model = *recorded;
+	return true;
+}
+
+bool KinectReplaySource::getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles)
+{
+	if (topologyOffset == 0)return false;
+
+	const ChunkHeader* chunk = (const ChunkHeader*)(data + topologyOffset);
+	if (chunk->size < sizeof(UINT32))return false;
+
+	const UINT32* values = (const UINT32*)(chunk + 1);
+	vertexCount = values[0];
+	triangles.assign(values + 1, values + chunk->size / sizeof(UINT32));
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,416 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofMain.h"
+#include <Kinect.h>
+#include <Kinect.Face.h>
+#include "ofxKinectFaceStats.h"
+
+template<class Interface>
+inline void SafeRelease(Interface *& pInterfaceToRelease)
+{
+	if (pInterfaceToRelease != NULL)
+	{
+		pInterfaceToRelease->Release();
+		pInterfaceToRelease = NULL;
+	}
+}
+
+enum KinectSourceMode
+{
+	KINECT_SOURCE_FACE,
+	KINECT_SOURCE_HD_FACE,
+};
+
+// streams a consumer needs, bodies are always read to target the face readers
+// and faces are always processed
+enum KinectFrameType
+{
+	KINECT_FRAME_COLOR = 0x01,
+	KINECT_FRAME_BODY = 0x02,
+	KINECT_FRAME_FACE = 0x04,
+	KINECT_FRAME_ALL = KINECT_FRAME_COLOR | KINECT_FRAME_BODY | KINECT_FRAME_FACE,
+};
+
+// FaceFrameFeatures of the face mode, every classifier left out saves sdk work per frame
+static const DWORD KINECT_FACE_FEATURE_PROPERTIES =
+	FaceFrameFeatures::FaceFrameFeatures_Happy
+	| FaceFrameFeatures::FaceFrameFeatures_RightEyeClosed
+	| FaceFrameFeatures::FaceFrameFeatures_LeftEyeClosed
+	| FaceFrameFeatures::FaceFrameFeatures_MouthOpen
+	| FaceFrameFeatures::FaceFrameFeatures_MouthMoved
+	| FaceFrameFeatures::FaceFrameFeatures_LookingAway
+	| FaceFrameFeatures::FaceFrameFeatures_Glasses
+	| FaceFrameFeatures::FaceFrameFeatures_FaceEngagement;
+static const DWORD KINECT_FACE_FEATURES_MINIMAL =
+	FaceFrameFeatures::FaceFrameFeatures_BoundingBoxInColorSpace
+	| FaceFrameFeatures::FaceFrameFeatures_RotationOrientation;
+static const DWORD KINECT_FACE_FEATURES_ALL =
+	KINECT_FACE_FEATURES_MINIMAL
+	| FaceFrameFeatures::FaceFrameFeatures_PointsInColorSpace
+	| KINECT_FACE_FEATURE_PROPERTIES;
+
+// face results of one slot, as delivered by a frame source.
+// outputs outside the source's face features are left untouched
+struct KinectFaceData
+{
+	bool isActive; // set by the caller, sources skip inactive slots
+	bool isUpdated;
+	UINT64 trackingId;
+	RectI boundingBox;
+	PointF points[FacePointType::FacePointType_Count];
+	Vector4 rotation;
+	DetectionResult properties[FaceProperty::FaceProperty_Count];
+};
+
+// hd face results of one slot, vertices are written to the caller's buffer
+struct KinectHDFaceData
+{
+	bool isActive; // set by the caller, sources skip inactive slots
+	bool isUpdated;
+	UINT64 trackingId;
+	CameraSpacePoint headPivot;
+	Vector4 orientation;
+	float animationUnits[FaceShapeAnimations_Count];
+	CameraSpacePoint* vertices;
+	UINT vertexCount;
+	bool isVertexRequested; // set by the caller, false leaves the vertices untouched
+	bool isVertexUpdated;   // false when the alignment did not change or vertices were not requested
+};
+
+enum KinectFaceModelStatus
+{
+	KINECT_MODEL_GENERIC,    // average face, nothing is collected
+	KINECT_MODEL_COLLECTING, // the builder collects views of the person
+	KINECT_MODEL_FITTED,     // vertices use the person's own shape
+};
+
+// shape of one person's hd face model, small enough to cache per person
+struct KinectFaceModel
+{
+	float scale;
+	float deformations[FaceShapeDeformations_Count];
+
+	KinectFaceModel();
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+};
+
+// pinhole approximation of the camera to color space mapping
+struct KinectColorProjection
+{
+	float fx, fy;
+	float cx, cy;
+	float tx, ty;
+
+	KinectColorProjection();
+	bool fit(ICoordinateMapper* mapper);
+	void project(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count) const;
+	// one point at a time, what project() runs on targets without sse2 and for its tail
+	void projectScalar(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count) const;
+};
+
+// converts packed yuy2 (2 bytes per pixel) to rgba, pixelCount must be even
+void KinectConvertYuy2ToRgba(const unsigned char* src, unsigned char* dst, int pixelCount);
+
+// why a face result was not accepted as valid
+enum KinectFaceRejection
+{
+	KINECT_FACE_ACCEPTED,
+	KINECT_FACE_RECT_OUTSIDE,   // bounding box corner outside the color frame
+	KINECT_FACE_POINT_OUTSIDE,  // a face point outside the color frame
+	KINECT_FACE_PIVOT_OUTSIDE,  // head pivot projects outside the color frame
+	KINECT_FACE_NO_ROTATION,    // all zero quaternion
+	KINECT_FACE_REJECTION_COUNT,
+};
+
+// validate results against a color frame of width x height, pure and safe to call from any thread.
+// face results are only checked for the outputs within features
+KinectFaceRejection KinectValidateFace(const KinectFaceData& face, int width, int height, DWORD features = KINECT_FACE_FEATURES_ALL);
+KinectFaceRejection KinectValidateHDFace(const KinectHDFaceData& face, const KinectColorProjection& projection, int width, int height);
+
+#pragma mark - KinectVertexCodec
+
+// default quantization step in meters, offsets up to +-0.32m from the head pivot fit in int16
+static const float KINECT_VERTEX_STEP = 0.00001f;
+
+enum KinectVertexBlockType
+{
+	KINECT_VERTEX_BLOCK_RAW = 1, // floats, when an offset does not fit in int16
+	KINECT_VERTEX_BLOCK_KEY,     // int16 offsets from the pivot
+	KINECT_VERTEX_BLOCK_DELTA,   // zigzag varint differences to the offsets of baseFrame
+};
+
+// encoded vertices: KinectVertexBlock followed by payloadSize bytes
+struct KinectVertexBlock
+{
+	UINT8 type;
+	UINT8 reserved[3];
+	UINT32 count;
+	UINT32 frame;
+	UINT32 baseFrame;
+	float step;
+	CameraSpacePoint pivot;
+	UINT32 payloadSize;
+};
+
+// quantizes hd face vertices relative to the head pivot and codes them as temporal deltas,
+// decoded vertices are within step / 2 of the input on every frame
+class KinectVertexEncoder
+{
+public:
+	KinectVertexEncoder(int keyFrameInterval = 30, float step = KINECT_VERTEX_STEP);
+
+	void setKeyFrameInterval(int frames);
+	// the next frame is encoded as a key frame
+	void reset();
+	// appends one block to out and returns its size
+	UINT32 encode(const CameraSpacePoint& pivot, const CameraSpacePoint* vertices, UINT32 count, std::vector<BYTE>& out);
+
+private:
+	int keyFrameInterval;
+	int framesSinceKey;
+	float step;
+	UINT32 frame;
+	std::vector<INT16> quantized;
+	std::vector<INT16> reference; // offsets as the decoder holds them
+};
+
+class KinectVertexDecoder
+{
+public:
+	KinectVertexDecoder();
+
+	// false for malformed blocks and deltas whose base frame was not decoded
+	bool decode(const BYTE* data, UINT32 size, CameraSpacePoint* vertices, UINT32 count);
+
+private:
+	UINT32 frame;
+	std::vector<INT16> reference;
+};
+
+#pragma mark - KinectFrameSource
+
+// provides color, body and face frames to the face pipelines
+class KinectFrameSource
+{
+public:
+	KinectFrameSource() : stats(nullptr), faceFeatures(KINECT_FACE_FEATURES_ALL){};
+	virtual ~KinectFrameSource(){};
+
+	virtual bool open(KinectSourceMode mode, int frames = KINECT_FRAME_ALL) = 0;
+	virtual void close() = 0;
+
+	// returns true when a new color frame was written to pixels,
+	// 2 channel pixels are filled with yuy2 and 4 channel pixels with rgba
+	virtual bool acquireColor(ofPixels& pixels, INT64& time) = 0;
+	// consumes a new color frame like acquireColor() without copying or converting its pixels
+	virtual bool skipColor(INT64& time) = 0;
+	// returns true when a new body frame arrived, untracked slots get id 0
+	virtual bool acquireBodies(UINT64* trackingIds, INT64& time) = 0;
+	// faces and hdFaces point to BODY_COUNT entries
+	virtual bool acquireFaces(KinectFaceData* faces) = 0;
+	virtual bool acquireHDFaces(KinectHDFaceData* hdFaces) = 0;
+	virtual bool getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles) = 0;
+	// blocks until new data may be acquired, false on timeout
+	virtual bool waitForFrame(DWORD timeoutMillis);
+	// true once no frame will ever arrive again, stops the pipeline's worker
+	virtual bool isExhausted();
+
+	// hd face model of a slot, sources without a sensor always use the generic model.
+	// a slot restarts collecting when it is retargeted to another body
+	virtual KinectFaceModelStatus getFaceModelStatus(int idx);
+	virtual bool getFaceModel(int idx, KinectFaceModel& model);
+	// uses a known shape right away and stops collecting
+	virtual bool setFaceModel(int idx, const KinectFaceModel& model);
+
+	virtual bool mapCameraToColor(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count);
+	virtual KinectColorProjection getColorProjection();
+	// stages inside the source are recorded here, owned by the pipeline
+	virtual void setStats(KinectStats* stats);
+	// FaceFrameFeatures requested by the face mode, takes effect at open()
+	virtual void setFaceFeatures(DWORD features);
+
+protected:
+	KinectColorProjection projection;
+	KinectStats* stats;
+	DWORD faceFeatures;
+};
+
+#pragma mark - KinectLiveSource
+
+// frames from the default kinect sensor
+class KinectLiveSource : public KinectFrameSource
+{
+public:
+	KinectLiveSource();
+	~KinectLiveSource();
+
+	bool open(KinectSourceMode mode, int frames = KINECT_FRAME_ALL);
+	void close();
+	bool acquireColor(ofPixels& pixels, INT64& time);
+	bool skipColor(INT64& time);
+	bool acquireBodies(UINT64* trackingIds, INT64& time);
+	bool acquireFaces(KinectFaceData* faces);
+	bool acquireHDFaces(KinectHDFaceData* hdFaces);
+	bool getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles);
+	bool waitForFrame(DWORD timeoutMillis);
+	bool mapCameraToColor(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count);
+	KinectColorProjection getColorProjection();
+	KinectFaceModelStatus getFaceModelStatus(int idx);
+	bool getFaceModel(int idx, KinectFaceModel& model);
+	bool setFaceModel(int idx, const KinectFaceModel& model);
+
+private:
+	void updateTrackingId(int idx);
+	HRESULT resetFaceModel(int idx);
+	void pollFaceModel(int idx);
+
+	KinectSourceMode mode;
+	UINT64 bodyTrackingIds[BODY_COUNT];
+	bool isFaceTracked[BODY_COUNT];
+	IKinectSensor* sensor;
+	IColorFrameReader* colorFrameReader;
+	IBodyFrameReader* bodyFrameReader;
+	ICoordinateMapper* coordinateMapper;
+	WAITABLE_HANDLE colorFrameEvent;
+	WAITABLE_HANDLE bodyFrameEvent;
+	WAITABLE_HANDLE faceFrameEvents[BODY_COUNT];
+
+	IFaceFrameSource* faceFrameSources[BODY_COUNT];
+	IFaceFrameReader* faceFrameReaders[BODY_COUNT];
+
+	IHighDefinitionFaceFrameSource*	hdFaceFrameSources[BODY_COUNT];
+	IHighDefinitionFaceFrameReader*	hdFaceFrameReaders[BODY_COUNT];
+	IFaceModelBuilder* faceModelBuilders[BODY_COUNT];
+	IFaceModel* faceModel[BODY_COUNT];
+	KinectFaceModelStatus modelStatus[BODY_COUNT];
+
+	// inputs of the last vertex calculation, an identical alignment skips the next one
+	struct AlignmentKey
+	{
+		CameraSpacePoint headPivot;
+		Vector4 orientation;
+		float animationUnits[FaceShapeAnimations_Count];
+	};
+	AlignmentKey vertexKeys[BODY_COUNT];
+	bool hasVertexKey[BODY_COUNT];
+	UINT64 modelTrackingIds[BODY_COUNT]; // body the model belongs to
+	IFaceAlignment* faceAlignment[BODY_COUNT];
+};
+
+#pragma mark - KinectRecorder
+
+// passes frames of another source through and writes them to a file
+class KinectRecorder : public KinectFrameSource
+{
+public:
+	KinectRecorder(KinectFrameSource* source, const std::string& path, bool recordColor = false);
+	~KinectRecorder();
+
+	bool open(KinectSourceMode mode, int frames = KINECT_FRAME_ALL);
+	void close();
+	bool acquireColor(ofPixels& pixels, INT64& time);
+	bool skipColor(INT64& time);
+	bool acquireBodies(UINT64* trackingIds, INT64& time);
+	bool acquireFaces(KinectFaceData* faces);
+	bool acquireHDFaces(KinectHDFaceData* hdFaces);
+	bool getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles);
+	bool waitForFrame(DWORD timeoutMillis);
+	bool isExhausted();
+	bool mapCameraToColor(const CameraSpacePoint* src, ColorSpacePoint* dst, UINT count);
+	KinectColorProjection getColorProjection();
+	void setStats(KinectStats* stats);
+	void setFaceFeatures(DWORD features);
+	KinectFaceModelStatus getFaceModelStatus(int idx);
+	bool getFaceModel(int idx, KinectFaceModel& model);
+	bool setFaceModel(int idx, const KinectFaceModel& model);
+
+private:
+	void writeChunk(UINT32 type, INT64 time, const void* data, UINT32 size);
+	void writeFrame(const ofPixels* pixels, INT64 time);
+
+	KinectFrameSource* source;
+	std::string path;
+	bool recordColor;
+	int frames;
+	FILE* file;
+	INT64 frameTime;
+	std::vector<char> chunk;
+	// key frames only, so replay can seek to any frame
+	KinectVertexEncoder vertexEncoder;
+	std::vector<BYTE> encoded;
+	std::vector<CameraSpacePoint> lastVertices[BODY_COUNT]; // for faces whose vertices were not recalculated
+	UINT64 recordedModelIds[BODY_COUNT]; // body whose fitted shape was written last, per slot
+};
+
+#pragma mark - KinectReplaySource
+
+// frames from a memory mapped recording
+class KinectReplaySource : public KinectFrameSource
+{
+public:
+	KinectReplaySource(const std::string& path, bool realtime = true, bool loop = true);
+	~KinectReplaySource();
+
+	bool open(KinectSourceMode mode, int frames = KINECT_FRAME_ALL);
+	void close();
+	bool acquireColor(ofPixels& pixels, INT64& time);
+	bool skipColor(INT64& time);
+	bool acquireBodies(UINT64* trackingIds, INT64& time);
+	bool acquireFaces(KinectFaceData* faces);
+	bool acquireHDFaces(KinectHDFaceData* hdFaces);
+	bool getFaceTopology(UINT32& vertexCount, std::vector<UINT32>& triangles);
+	bool waitForFrame(DWORD timeoutMillis);
+	bool isExhausted();
+	// shapes fitted while recording, setFaceModel() is not supported
+	KinectFaceModelStatus getFaceModelStatus(int idx);
+	bool getFaceModel(int idx, KinectFaceModel& model);
+
+	int getFrameCount();
+	int getFrameIndex();
+	void setFrameIndex(int index);
+	// FaceFrameFeatures the face mode was recorded with
+	DWORD getRecordedFaceFeatures();
+
+private:
+	bool advanceFrame(INT64& time);
+	const BYTE* findChunk(UINT32 type, UINT32& size);
+	bool acquireHDFacesV1(const BYTE* chunk, const BYTE* end, KinectHDFaceData* hdFaces);
+	const KinectFaceModel* findFaceModel(int idx);
+
+	struct RecordedModel
+	{
+		int frame;
+		UINT32 slot;
+		UINT64 trackingId;
+		KinectFaceModel model;
+	};
+
+	std::string path;
+	bool isRealtime;
+	bool isLooping;
+	int frames;
+	HANDLE file;
+	HANDLE mapping;
+	const BYTE* data;
+	UINT64 dataSize;
+	UINT32 version; // of the open recording, older layouts are read as they were written
+	std::vector<UINT64> frameOffsets;
+	UINT64 topologyOffset;
+	int frameIndex;
+	int bodyFrameIndex;
+	INT64 firstFrameTime;
+	unsigned long long startMicros;
+	DWORD recordedFeatures;
+	KinectVertexDecoder vertexDecoder;
+	UINT64 bodyTrackingIds[BODY_COUNT]; // from the latest body frame
+	std::vector<RecordedModel> faceModels; // in frame order
+};
\ No newline at end of file
@@ -0,0 +1,285 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#include "ofxKinectFaceStats.h"
+
+// trace events are written out in batches of this size
+static const size_t TRACE_BATCH = 4096;
+
+static const char* STAGE_NAMES[] =
+{
+	"frame",
+	"acquire",
+	"convert",
+	"convert pixels",
+	"upload",
+	"face acquire",
+	"alignment",
+	"vertices",
+	"projection",
+	"filter",
+	"draw",
+	"latency",
+};
+
+// values below 8 get their own bucket, then 8 buckets per power of two
+static int bucketOf(UINT64 value)
+{
+	if (value < 8)return (int)value;
+
+	int exponent = 3;
+	while (exponent < 63 && (value >> (exponent + 1)) != 0)exponent++;
+	return 8 + (exponent - 3) * 8 + (int)((value >> (exponent - 3)) & 7);
+}
+
+static UINT64 bucketUpperBound(int bucket)
+{
+	if (bucket < 8)return bucket;
+
+	int exponent = 3 + (bucket - 8) / 8;
+	UINT64 sub = (bucket - 8) % 8;
+	return ((8 + sub + 1) << (exponent - 3)) - 1;
+}
+
+#pragma mark - KinectHistogram
+
+KinectHistogram::KinectHistogram()
+{
+	reset();
+}
+
+void KinectHistogram::add(UINT64 micros)
+{
+	buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(micros, std::memory_order_relaxed);
+	UINT64 current = max.load(std::memory_order_relaxed);
+	while (micros > current && !max.compare_exchange_weak(current, micros, std::memory_order_relaxed));
+}
+
+void KinectHistogram::reset()
+{
+	for (int i = 0; i < BUCKET_COUNT; i++)
+	{
+		buckets[i].store(0, std::memory_order_relaxed);
+	}
+	count.store(0);
+	total.store(0);
+	max.store(0);
+}
+
+UINT64 KinectHistogram::getCount() const
+{
+	return count.load(std::memory_order_relaxed);
+}
+
+UINT64 KinectHistogram::getMax() const
+{
+	return max.load(std::memory_order_relaxed);
+}
+
+double KinectHistogram::getMean() const
+{
+	UINT64 n = getCount();
+	return n > 0 ? (double)total.load(std::memory_order_relaxed) / n : 0.0;
+}
+
+UINT64 KinectHistogram::getPercentile(float p) const
+{
+	UINT64 n = getCount();
+	if (n == 0)return 0;
+
+	UINT64 rank = (UINT64)ceil(ofClamp(p, 0.f, 1.f) * n);
+	UINT64 seen = 0;
+	for (int i = 0; i < BUCKET_COUNT; i++)
+	{
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank && seen > 0)return MIN(bucketUpperBound(i), getMax());
+	}
+	return getMax();
+}
+
+#pragma mark - KinectStats
+
+KinectStats::KinectStats()
+	: enabled(false)
+	, latencyOffset(LLONG_MAX)
+	, isTracing(false)
+	, traceFile(NULL)
+	, hasTraceEvent(false)
+{
+	for (int c = 0; c < KINECT_COUNTER_COUNT; c++)
+	{
+		counters[c] = 0;
+	}
+}
+
+KinectStats::~KinectStats()
+{
+	stopTrace();
+}
+
+void KinectStats::setEnabled(bool isEnabled)
+{
+	enabled = isEnabled;
+}
+
+void KinectStats::reset()
+{
+	for (int s = 0; s < KINECT_STAGE_COUNT; s++)
+	{
+		histograms[s].reset();
+	}
+	for (int c = 0; c < KINECT_COUNTER_COUNT; c++)
+	{
+		counters[c] = 0;
+	}
+	latencyOffset = LLONG_MAX;
+}
+
+void KinectStats::record(KinectStage stage, UINT64 beginMicros, UINT64 endMicros)
+{
+	UINT64 duration = endMicros > beginMicros ? endMicros - beginMicros : 0;
+	histograms[stage].add(duration);
+
+	if (!isTracing)return;
+
+	TraceEvent event = { stage, GetCurrentThreadId(), beginMicros, duration };
+	ofScopedLock lock(traceMutex);
+	if (!isTracing)return;
+
+	traceEvents.push_back(event);
+	if (traceEvents.size() >= TRACE_BATCH)
+	{
+		flushTrace();
+	}
+}
+
+void KinectStats::recordLatency(INT64 sensorTime, UINT64 hostMicros)
+{
+	if (!enabled || sensorTime == 0)return;
+
+	INT64 offset = (INT64)hostMicros - sensorTime / 10;
+	if (offset < latencyOffset)latencyOffset = offset;
+	histograms[KINECT_STAGE_LATENCY].add(offset - latencyOffset);
+}
+
+void KinectStats::count(KinectCounter counter, UINT64 amount)
+{
+	if (enabled)counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+UINT64 KinectStats::getCount(KinectCounter counter) const
+{
+	return counters[counter].load(std::memory_order_relaxed);
+}
+
+const KinectHistogram& KinectStats::getHistogram(KinectStage stage) const
+{
+	return histograms[stage];
+}
+
+UINT64 KinectStats::getPercentile(KinectStage stage, float p) const
+{
+	return histograms[stage].getPercentile(p);
+}
+
+const char* KinectStats::getStageName(KinectStage stage)
+{
+	return (stage >= 0 && stage < KINECT_STAGE_COUNT) ? STAGE_NAMES[stage] : "";
+}
+
+std::string KinectStats::getSummary() const
+{
+	std::string text;
+	for (int s = 0; s < KINECT_STAGE_COUNT; s++)
+	{
+		const KinectHistogram& h = histograms[s];
+		if (h.getCount() == 0)continue;
+
+		text += std::string(STAGE_NAMES[s]) + " : " + ofToString(h.getCount())
+			+ " mean " + ofToString(h.getMean(), 0)
+			+ " p50 " + ofToString(h.getPercentile(0.5f))
+			+ " p95 " + ofToString(h.getPercentile(0.95f))
+			+ " p99 " + ofToString(h.getPercentile(0.99f))
+			+ " max " + ofToString(h.getMax()) + " us\n";
+	}
+
+	// reused vertices save about one mean vertex calculation each
+	UINT64 calculated = getCount(KINECT_COUNT_VERTICES_CALCULATED);
+	UINT64 reused = getCount(KINECT_COUNT_VERTICES_REUSED);
+	if (calculated + reused > 0)
+	{
+		text += "vertices reused : " + ofToString(reused) + " of " + ofToString(calculated + reused)
+			+ " (" + ofToString(100.0 * reused / (calculated + reused), 1) + "%), saved about "
+			+ ofToString(reused * histograms[KINECT_STAGE_VERTICES].getMean() / 1000.0, 1) + " ms\n";
+	}
+	UINT64 uploads = getCount(KINECT_COUNT_MESH_UPLOADS);
+	UINT64 skipped = getCount(KINECT_COUNT_MESH_UPLOADS_SKIPPED);
+	if (uploads + skipped > 0)
+	{
+		text += "mesh uploads skipped : " + ofToString(skipped) + " of " + ofToString(uploads + skipped)
+			+ " (" + ofToString(100.0 * skipped / (uploads + skipped), 1) + "%)\n";
+	}
+	if (uploads > 0)
+	{
+		text += "vertices per upload : " + ofToString((double)getCount(KINECT_COUNT_VERTICES_UPLOADED) / uploads, 1) + "\n";
+	}
+	if (getCount(KINECT_COUNT_COLOR_SKIPPED) > 0)
+	{
+		text += "color frames skipped : " + ofToString(getCount(KINECT_COUNT_COLOR_SKIPPED)) + "\n";
+	}
+	if (getCount(KINECT_COUNT_FACES_SKIPPED) > 0)
+	{
+		text += "faces skipped : " + ofToString(getCount(KINECT_COUNT_FACES_SKIPPED)) + "\n";
+	}
+	return text;
+}
+
+bool KinectStats::startTrace(const std::string& path)
+{
+	stopTrace();
+
+	ofScopedLock lock(traceMutex);
+	traceFile = fopen(ofToDataPath(path).c_str(), "w");
+	if (!traceFile)
+	{
+		ofLogError("KinectStats") << "could not open " << path;
+		return false;
+	}
+	fputs("{\"traceEvents\":[\n", traceFile);
+	hasTraceEvent = false;
+	isTracing = true;
+	return true;
+}
+
+void KinectStats::stopTrace()
+{
+	ofScopedLock lock(traceMutex);
+	if (!traceFile)return;
+
+	isTracing = false;
+	flushTrace();
+	fputs("\n]}\n", traceFile);
+	fclose(traceFile);
+	traceFile = NULL;
+}
+
+// complete events, timestamps in microseconds since the app started
+void KinectStats::flushTrace()
+{
+	for (size_t i = 0; i < traceEvents.size(); i++)
+	{
+		const TraceEvent& e = traceEvents[i];
+		fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%lu,\"ts\":%llu,\"dur\":%llu}",
+			hasTraceEvent ? ",\n" : "", STAGE_NAMES[e.stage], (unsigned long)e.thread,
+			(unsigned long long)e.begin, (unsigned long long)e.duration);
+		hasTraceEvent = true;
+	}
+	traceEvents.clear();
+}
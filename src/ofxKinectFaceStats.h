@@ -0,0 +1,145 @@
+//
+//  ofxKinectFace
+//
+//  Created by flatscape
+//
+//  Released under the MIT license
+//  http://opensource.org/licenses/mit-license.php
+//
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+
+enum KinectStage
+{
+	KINECT_STAGE_FRAME,        // whole worker pass of one frame
+	KINECT_STAGE_ACQUIRE,      // color and body frames from the source
+	KINECT_STAGE_CONVERT,      // color format conversion on the worker
+	KINECT_STAGE_CONVERT_PIXELS, // color format conversion in getColorPixels(), on the caller's thread
+	KINECT_STAGE_UPLOAD,       // color texture and face mesh uploads
+	KINECT_STAGE_FACE_ACQUIRE, // face results from the source
+	KINECT_STAGE_ALIGNMENT,    // hd face alignment refresh
+	KINECT_STAGE_VERTICES,     // hd face vertex calculation or decoding
+	KINECT_STAGE_PROJECTION,   // camera to color space mapping
+	KINECT_STAGE_FILTER,       // temporal smoothing
+	KINECT_STAGE_DRAW,
+	KINECT_STAGE_LATENCY,      // sensor time to the update() that made the frame visible
+	KINECT_STAGE_COUNT,
+};
+
+enum KinectCounter
+{
+	KINECT_COUNT_VERTICES_CALCULATED, // faces whose vertices were calculated or decoded
+	KINECT_COUNT_VERTICES_REUSED,     // faces whose alignment did not change
+	KINECT_COUNT_MESH_UPLOADS,
+	KINECT_COUNT_MESH_UPLOADS_SKIPPED, // draws with no changed face
+	KINECT_COUNT_VERTICES_UPLOADED,    // packed vertices of all uploads, fewer with lod levels
+	KINECT_COUNT_COLOR_SKIPPED,        // color frames consumed without their pixels
+	KINECT_COUNT_FACES_SKIPPED,        // tracked slots left out of a frame by the quality scheduler
+	KINECT_COUNTER_COUNT,
+};
+
+#pragma mark - KinectHistogram
+
+// log linear histogram of microseconds, 8 buckets per power of two (within 12.5%).
+// any thread may add, readers on any thread see a slightly stale state
+class KinectHistogram
+{
+public:
+	enum { BUCKET_COUNT = 8 + 61 * 8 };
+
+	KinectHistogram();
+
+	void add(UINT64 micros);
+	void reset();
+	UINT64 getCount() const;
+	UINT64 getMax() const;
+	double getMean() const;
+	// p in 0..1, upper bound of the bucket holding the percentile
+	UINT64 getPercentile(float p) const;
+
+private:
+	std::atomic<UINT32> buckets[BUCKET_COUNT];
+	std::atomic<UINT64> count;
+	std::atomic<UINT64> total;
+	std::atomic<UINT64> max;
+};
+
+#pragma mark - KinectStats
+
+// per stage timings of one pipeline, off by default and nearly free while off
+class KinectStats
+{
+public:
+	KinectStats();
+	~KinectStats();
+
+	void setEnabled(bool isEnabled);
+	bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+	void reset();
+
+	void record(KinectStage stage, UINT64 beginMicros, UINT64 endMicros);
+	// sensor time in 100ns units, the offset to the host clock is taken from the fastest frame
+	// so latencies are relative to the best delivery seen so far
+	void recordLatency(INT64 sensorTime, UINT64 hostMicros);
+	void count(KinectCounter counter, UINT64 amount = 1);
+
+	const KinectHistogram& getHistogram(KinectStage stage) const;
+	UINT64 getPercentile(KinectStage stage, float p) const;
+	UINT64 getCount(KinectCounter counter) const;
+	static const char* getStageName(KinectStage stage);
+	// one line per stage with samples: name, count, mean, p50, p95, p99 and max in microseconds,
+	// then the skip rates of the vertex and mesh caches and the quality scheduler
+	std::string getSummary() const;
+
+	// chrome://tracing json of every recorded stage until stopTrace()
+	bool startTrace(const std::string& path);
+	void stopTrace();
+
+private:
+	struct TraceEvent
+	{
+		KinectStage stage;
+		DWORD thread;
+		UINT64 begin;
+		UINT64 duration;
+	};
+
+	void flushTrace();
+
+	std::atomic<bool> enabled; // written by the app, read by every timer on the worker
+	KinectHistogram histograms[KINECT_STAGE_COUNT];
+	std::atomic<UINT64> counters[KINECT_COUNTER_COUNT];
+	std::atomic<INT64> latencyOffset;
+
+	std::atomic<bool> isTracing; // checked without the lock on every record()
+	ofMutex traceMutex;
+	FILE* traceFile;
+	bool hasTraceEvent;
+	std::vector<TraceEvent> traceEvents;
+};
+
+#pragma mark - KinectScopedTimer
+
+// records the time until it goes out of scope
+class KinectScopedTimer
+{
+public:
+	KinectScopedTimer(KinectStats* stats, KinectStage stage)
+		: stats(stats && stats->isEnabled() ? stats : nullptr)
+		, stage(stage)
+		, begin(this->stats ? ofGetElapsedTimeMicros() : 0)
+	{
+	}
+
+	~KinectScopedTimer()
+	{
+		if (stats)stats->record(stage, begin, ofGetElapsedTimeMicros());
+	}
+
+private:
+	KinectStats* stats;
+	KinectStage stage;
+	UINT64 begin;
+};